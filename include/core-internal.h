@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: Apache-2.0 OR GPL-2.0-or-later */
 #pragma once
 
+#include <assert.h>
+
 #include "libmctp.h"
 
 /* 64kb should be sufficient for a single message. Applications
@@ -9,21 +11,98 @@
 #define MCTP_MAX_MESSAGE_SIZE 65536
 #endif
 
+/* Initial allocation for a reassembly buffer. Buffers grow geometrically
+ * from this size as fragments arrive, up to max_message_size. */
+#ifndef MCTP_REASSEMBLY_INITIAL_SIZE
+#define MCTP_REASSEMBLY_INITIAL_SIZE 1024
+#endif
+
+/* Reassembly timeout, in milliseconds. A context left open for longer
+ * than this may be evicted to make room for a new message. */
+#ifndef MCTP_REASSEMBLY_TIMEOUT
+#define MCTP_REASSEMBLY_TIMEOUT 6000
+#endif
+
+/* Registered stream handlers */
+#ifndef MCTP_STREAM_HANDLERS
+#define MCTP_STREAM_HANDLERS 4
+#endif
+
+/* Default per-bus TX queue limits, in messages and in bytes. A message
+ * is always accepted onto an empty queue, whatever its size. */
+#ifndef MCTP_TX_QUEUE_DEPTH
+#define MCTP_TX_QUEUE_DEPTH 8
+#endif
+
+#ifndef MCTP_TX_QUEUE_BYTES
+#define MCTP_TX_QUEUE_BYTES (256 * 1024)
+#endif
+
+/* The same for the urgent class, which holds control messages */
+#ifndef MCTP_TX_URGENT_DEPTH
+#define MCTP_TX_URGENT_DEPTH 8
+#endif
+
+#ifndef MCTP_TX_URGENT_BYTES
+#define MCTP_TX_URGENT_BYTES (16 * 1024)
+#endif
+
+/* Consecutive urgent packets sent before a waiting bulk message is given
+ * one packet */
+#ifndef MCTP_TX_URGENT_RUN
+#define MCTP_TX_URGENT_RUN 8
+#endif
+
+/* Messages per bus that may have packets in flight at once, and packets
+ * sent from one message before the next gets a turn */
+#ifndef MCTP_TX_INFLIGHT_MAX
+#define MCTP_TX_INFLIGHT_MAX 16
+#endif
+
+#ifndef MCTP_TX_INFLIGHT
+#define MCTP_TX_INFLIGHT 4
+#endif
+
+#ifndef MCTP_TX_BURST
+#define MCTP_TX_BURST 1
+#endif
+
+static_assert(MCTP_TX_INFLIGHT >= 1 && MCTP_TX_INFLIGHT <= MCTP_TX_INFLIGHT_MAX,
+	      "TX in-flight limit");
+
+/* Packets per tx_batch call, unless the binding sets tx_batch_max */
+#ifndef MCTP_TX_BATCH
+#define MCTP_TX_BATCH 8
+#endif
+
 /* Must be >= 2 for bridge busses */
 #ifndef MCTP_MAX_BUSSES
-#define MCTP_MAX_BUSSES 2
+#define MCTP_MAX_BUSSES 4
 #endif
 
+static_assert(MCTP_MAX_BUSSES < UINT8_MAX, "bus index size");
+
 /* Concurrent reassembly contexts. */
 #ifndef MCTP_REASSEMBLY_CTXS
 #define MCTP_REASSEMBLY_CTXS 16
 #endif
 
+/* Buckets in the reassembly context hash index. Keep at least twice the
+ * context count so that probe runs stay short. */
+#ifndef MCTP_REASSEMBLY_HASH_SIZE
+#define MCTP_REASSEMBLY_HASH_SIZE (2 * MCTP_REASSEMBLY_CTXS)
+#endif
+
 /* Outbound request tags */
 #ifndef MCTP_REQ_TAGS
 #define MCTP_REQ_TAGS MCTP_REASSEMBLY_CTXS
 #endif
 
+/* Requests held for a free tag, across all peers */
+#ifndef MCTP_REQ_PENDING
+#define MCTP_REQ_PENDING 32
+#endif
+
 #ifndef MCTP_DEFAULT_CLOCK_GETTIME
 #define MCTP_DEFAULT_CLOCK_GETTIME 1
 #endif
@@ -32,6 +111,79 @@
 #define MCTP_CONTROL_HANDLER 1
 #endif
 
+/* Lock the core so that it can be used from several threads */
+#ifndef MCTP_THREAD_SAFE
+#define MCTP_THREAD_SAFE 0
+#endif
+
+#if MCTP_THREAD_SAFE
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* A recursive lock, see mctp_lock() */
+struct mctp_lock {
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+};
+
+static inline void mctp_lock_init(struct mctp_lock *lock)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(&lock->cs);
+#else
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lock->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
+}
+
+static inline void mctp_lock_destroy(struct mctp_lock *lock)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(&lock->cs);
+#else
+	pthread_mutex_destroy(&lock->mutex);
+#endif
+}
+
+static inline void mctp_lock(struct mctp_lock *lock)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&lock->cs);
+#else
+	pthread_mutex_lock(&lock->mutex);
+#endif
+}
+
+static inline void mctp_unlock(struct mctp_lock *lock)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&lock->cs);
+#else
+	pthread_mutex_unlock(&lock->mutex);
+#endif
+}
+#else
+#define mctp_lock_init(lock)	do {} while (0)
+#define mctp_lock_destroy(lock) do {} while (0)
+#define mctp_lock(lock)		do {} while (0)
+#define mctp_unlock(lock)	do {} while (0)
+#endif
+
+static_assert(MCTP_REASSEMBLY_CTXS < UINT16_MAX, "reassembly index size");
+static_assert(MCTP_REQ_TAGS < UINT16_MAX, "request tag index size");
+static_assert(MCTP_REASSEMBLY_HASH_SIZE > MCTP_REASSEMBLY_CTXS,
+	      "reassembly index must have spare buckets");
+
 /* Tag expiry timeout, in milliseconds */
 static const uint64_t MCTP_TAG_TIMEOUT = 6000;
 
@@ -43,32 +195,152 @@ enum mctp_bus_state {
 	mctp_bus_state_tx_disabled,
 };
 
+/* A message queued for transmission on a bus */
+struct mctp_tx_msg {
+	struct mctp_tx_msg *next;
+	/* Buffer to free when done, NULL if the regions are borrowed */
+	void *msg;
+	size_t iovcnt;
+	size_t len;
+	/* Position in msg and sequence number of the next unsent packet */
+	size_t pos;
+	uint8_t seq;
+	/* The same, counting packets built but not yet accepted by the
+	 * binding */
+	size_t next_pos;
+	uint8_t next_seq;
+	bool next_done;
+	/* Nonzero to continue a bridged message whose first packets were
+	 * forwarded already: no SOM, and packets of this payload length */
+	size_t cont_len;
+	mctp_eid_t src;
+	mctp_eid_t dest;
+	bool tag_owner;
+	uint8_t tag;
+	enum mctp_tx_class tx_class;
+	mctp_tx_done_fn done;
+	void *done_data;
+	/* mctp_now() when queued, 0 without a clock */
+	uint64_t start;
+	/* Completion status, once moved to the done list */
+	int status;
+	/* The message data */
+	struct mctp_iovec iov[];
+};
+
+/* Where a bridged message continues, after the packets forwarded */
+struct mctp_tx_cont {
+	uint8_t seq;
+	/* Payload length of those packets, which the rest must keep */
+	size_t pkt_len;
+};
+
+#define MCTP_TX_CLASSES 2
+
+/* Messages of one priority class queued on a bus, the first tx_inflight
+ * are interleaved */
+struct mctp_tx_queue {
+	struct mctp_tx_msg *head;
+	struct mctp_tx_msg *tail;
+	size_t len;
+	size_t bytes;
+	/* Message holding the round-robin turn, and its packets left */
+	struct mctp_tx_msg *cur;
+	size_t burst;
+	/* Where the round-robin resumes if cur was removed */
+	struct mctp_tx_msg *next;
+};
+
+/* Scheduler state, saved while packets are built ahead of the binding */
+struct mctp_tx_sched {
+	struct {
+		struct mctp_tx_msg *cur;
+		struct mctp_tx_msg *next;
+		size_t burst;
+	} q[MCTP_TX_CLASSES];
+	size_t urgent_run;
+};
+
+/* A packet handed to binding->tx_batch: its message, and the scheduler
+ * state from before it was picked */
+struct mctp_tx_batch_ent {
+	struct mctp_tx_msg *tx;
+	struct mctp_tx_sched sched;
+};
+
 struct mctp_bus {
 	mctp_eid_t eid;
 	struct mctp_binding *binding;
 	enum mctp_bus_state state;
 	struct mctp *mctp;
 
-	/* Current message to transmit */
-	void *tx_msg;
-	/* Position in tx_msg */
-	size_t tx_msgpos;
-	/* Length of tx_msg */
-	size_t tx_msglen;
-	/* Length of current packet payload */
-	size_t tx_pktlen;
-	uint8_t tx_seq;
-	uint8_t tx_src;
-	uint8_t tx_dest;
-	bool tx_to;
-	uint8_t tx_tag;
+#if MCTP_THREAD_SAFE
+	/* Covers the TX queues and the done list. Binding TX runs without
+	 * it, kept to one sender by tx_active. */
+	struct mctp_lock tx_lock;
+#endif
+
+	/* Messages to transmit, indexed by enum mctp_tx_class */
+	struct mctp_tx_queue tx_queues[MCTP_TX_CLASSES];
+	/* Urgent packets sent in a row while bulk messages waited */
+	size_t tx_urgent_run;
+	/* Finished messages, reported once the scheduler is settled */
+	struct mctp_tx_msg *tx_done;
+	struct mctp_tx_msg *tx_done_tail;
+	/* Packets handed to binding->tx_batch, where they came from, and
+	 * their storage */
+	struct mctp_pktbuf **tx_batch_pkts;
+	struct mctp_tx_batch_ent *tx_batch_ents;
+	void *tx_batch_storage;
+	size_t tx_batch_slot;
+	size_t tx_batch_max;
+	/* mctp_send_tx_queue() is running */
+	bool tx_active;
+
+	/* Allocated outbound TO tags, a bitmap per remote EID, and the
+	 * req_tags entry of each tag, index + 1 */
+	uint8_t req_tags_used[256];
+	uint16_t req_tag_slot[256][8];
+};
+
+/* One fragment of a message reassembled as a chain */
+struct mctp_msg_frag {
+	struct mctp_msg_frag *next;
+	size_t len;
+	unsigned char data[];
+};
 
-	/* todo: routing */
+/* A stream handler registration, unused if fn is NULL */
+struct mctp_stream_handler {
+	uint8_t msg_type;
+	mctp_eid_t src;
+	mctp_stream_fn fn;
+	void *data;
 };
 
 struct mctp_msg_ctx {
-	/* NULL buf indicates an unused mctp_msg_ctx */
+	bool in_use;
+	/* Stream handler receiving this message, not buffered if set */
+	struct mctp_stream_handler *stream;
+	bool tag_owner;
+	/* Reassemble as a fragment chain rather than into buf */
+	bool chain;
+	/* Bridge egress bus, packets are forwarded as they arrive and the
+	 * message is not buffered if set */
+	struct mctp_bus *fwd;
+	/* For an egress with another packet size, buf holds the egress
+	 * packet being filled. Payload bytes sent and the next egress
+	 * sequence number. */
+	size_t fwd_pos;
+	uint8_t fwd_seq;
+	/* The egress was busy mid-message. The payload from fwd_pos on is
+	 * held in frags, and queued on the egress at EOM to continue from
+	 * fwd_seq. */
+	bool fwd_held;
 	void *buf;
+	struct mctp_msg_frag *frags;
+	struct mctp_msg_frag *frags_tail;
+	size_t n_frags;
 
 	uint8_t src;
 	uint8_t dest;
@@ -77,15 +349,50 @@ struct mctp_msg_ctx {
 	size_t buf_size;
 	size_t buf_alloc_size;
 	size_t fragment_size;
+
+	/* mctp_now() at start of message, 0 without a clock */
+	uint64_t start;
+	/* msg_ctx_clock value at the last received fragment */
+	uint64_t last_used;
+};
+
+/* Message currently being delivered to the RX callback */
+struct mctp_rx_msg {
+	bool valid;
+	const struct mctp_iovec *iov;
+	size_t iovcnt;
+	size_t len;
+	/* Reference to a single-region message if it is a separate
+	 * allocation, NULL for a view into a packet buffer */
+	void **owner;
 };
 
 struct mctp_req_tag {
-	/* 0 is an unused entry */
 	mctp_eid_t local;
 	mctp_eid_t remote;
 	uint8_t tag;
+	/* Index of the bus holding the tag in its bitmap */
+	uint8_t bus;
 	/* time of tag expiry */
 	uint64_t expiry;
+	/* Response callback, may be NULL */
+	mctp_resp_fn fn;
+	void *data;
+	/* Expiry list links, entries are index + 1 */
+	uint16_t prev;
+	uint16_t next;
+};
+
+/* A request waiting for one of the tags to its peer to be freed */
+struct mctp_req_pending {
+	struct mctp_req_pending *next;
+	void *msg;
+	size_t len;
+	mctp_eid_t eid;
+	/* Index of the bus the request was made on */
+	uint8_t bus;
+	mctp_resp_fn fn;
+	void *data;
 };
 
 #define MCTP_CONTROL_MAX_TYPES 10
@@ -97,30 +404,89 @@ struct mctp_control {
 };
 
 struct mctp {
+	/* Registered busses. Slots below n_busses with a NULL binding were
+	 * unregistered and can be reused. */
 	int n_busses;
 	struct mctp_bus busses[MCTP_MAX_BUSSES];
+	/* Bus for each destination EID, or the default route if 0. Both
+	 * are bus index + 1. */
+	uint8_t routes[256];
+	uint8_t route_default;
+	/* Number of busses with each EID as their own */
+	uint8_t local_eids[256];
 
 	/* Message RX callback */
 	mctp_rx_fn message_rx;
 	void *message_rx_data;
+	mctp_rx_iov_fn message_rx_iov;
+	void *message_rx_iov_data;
+	struct mctp_rx_msg rx_msg;
+	struct mctp_stream_handler stream_handlers[MCTP_STREAM_HANDLERS];
 
 	/* Packet capture callback */
 	mctp_capture_fn capture;
 	void *capture_data;
 
+#if MCTP_THREAD_SAFE
+	/* Covers message reassembly and delivery */
+	struct mctp_lock rx_lock;
+	/* Covers the request tags and held requests */
+	struct mctp_lock tag_lock;
+#endif
+
 	/* Message reassembly. */
 	struct mctp_msg_ctx msg_ctxs[MCTP_REASSEMBLY_CTXS];
+	/* (src, dest, tag) hash index into msg_ctxs, entries are index + 1 */
+	uint16_t msg_ctx_index[MCTP_REASSEMBLY_HASH_SIZE];
+	/* Stack of unused msg_ctxs indices */
+	uint16_t msg_ctx_free[MCTP_REASSEMBLY_CTXS];
+	size_t n_msg_ctx_free;
+	/* Most recently used context, checked before the index */
+	struct mctp_msg_ctx *msg_ctx_last;
+	/* Counter for context LRU ordering */
+	uint64_t msg_ctx_clock;
+	uint64_t reassembly_timeout;
+	bool reassembly_evict_lru;
 
-	/* Allocated outbound TO tags */
+	/* Allocated outbound TO tags. Entries in use are listed in
+	 * allocation order, which is also expiry order. */
 	struct mctp_req_tag req_tags[MCTP_REQ_TAGS];
+	/* Expiry list ends, index + 1 */
+	uint16_t req_tag_head;
+	uint16_t req_tag_tail;
+	/* Stack of unused req_tags indices */
+	uint16_t req_tag_free[MCTP_REQ_TAGS];
+	size_t n_req_tag_free;
 	/* used to avoid always allocating tag 0 */
 	uint8_t tag_round_robin;
+	mctp_tag_filter_fn tag_filter;
+	void *tag_filter_data;
+	/* Requests waiting for a tag, oldest first. Requests to one peer
+	 * are sent in order. */
+	struct mctp_req_pending *req_pending;
+	struct mctp_req_pending *req_pending_tail;
+	size_t req_pending_limit;
+	bool req_pending_active;
+	/* A tag or TX queue room was freed since the held requests were
+	 * last tried */
+	bool req_pending_ready;
+	/* Bumped when held requests are cancelled */
+	unsigned int req_pending_gen;
+	/* A response freed a tag in this mctp_bus_rx(), under rx_lock */
+	bool rx_tag_freed;
+	struct mctp_req_stats req_stats;
 
 	enum {
 		ROUTE_ENDPOINT,
 		ROUTE_BRIDGE,
 	} route_policy;
 	size_t max_message_size;
+	size_t reassembly_initial_size;
+	size_t tx_queue_depth[MCTP_TX_CLASSES];
+	size_t tx_queue_bytes[MCTP_TX_CLASSES];
+	size_t tx_urgent_run;
+	size_t tx_inflight;
+	size_t tx_burst;
 
 #if MCTP_CONTROL_HANDLER
 	struct mctp_control control;
@@ -13,6 +13,36 @@ extern "C" {
 #include <windows.h>
 #endif
 
+/* Something to block on until there is work: an event HANDLE on Windows,
+ * or a file descriptor to poll() for reading elsewhere */
+#ifndef MCTP_WAIT_HANDLE_DEFINED
+#define MCTP_WAIT_HANDLE_DEFINED
+#ifdef _WIN32
+typedef HANDLE mctp_wait_handle_t;
+#else
+typedef int mctp_wait_handle_t;
+#endif
+#endif
+
+struct mctp_ring;
+
+enum mctp_mmbi_poll_mode {
+	MCTP_MMBI_POLL_BLOCK,
+	MCTP_MMBI_POLL_SPIN,
+};
+
+struct mctp_mmbi_poll_stats {
+	/* SPIN while inside the window after the last activity */
+	enum mctp_mmbi_poll_mode mode;
+	/* Waits that spun, and those that found work before the window
+	 * closed. spin_hits / spin_waits is the spin hit rate. */
+	uint64_t spin_waits;
+	uint64_t spin_hits;
+	/* Waits that blocked, and those woken before the timeout */
+	uint64_t blocks;
+	uint64_t block_wakes;
+};
+
 struct mctp_binding_mmbi {
 	struct mctp_binding binding;
 	void *rx_storage;
@@ -21,7 +51,23 @@ struct mctp_binding_mmbi {
 	void *device_handle; /* HANDLE on Windows */
 #ifdef _WIN32
 	CRITICAL_SECTION lock;
+	/* Device mode keeps one read in flight, completing on rx_event */
+	OVERLAPPED rx_ov;
+	bool rx_pending;
+	HANDLE rx_event;
+	HANDLE tx_event;
 #endif
+	uint8_t *rx_buf;
+	/* Signalled by mctp_mmbi_notify() */
+	mctp_wait_handle_t wait_handle;
+	/* Pipeline mode: received packets waiting for mctp_mmbi_process() */
+	struct mctp_ring *rx_ring;
+	/* Packets dropped because rx_ring was full */
+	size_t rx_dropped;
+	/* Hybrid polling, see mctp_mmbi_set_poll_policy() */
+	uint32_t spin_us;
+	uint64_t last_activity_us;
+	struct mctp_mmbi_poll_stats poll_stats;
 };
 
 struct mctp_binding_mmbi *mctp_mmbi_init(void);
@@ -43,9 +89,55 @@ int mctp_mmbi_init_device(struct mctp_binding_mmbi *mmbi, const char *device_pat
 /* Function to be called when data is available in the RX memory region */
 int mctp_mmbi_rx(struct mctp_binding_mmbi *mmbi, size_t len);
 
-/* Poll for incoming data from the device */
+/* Poll for incoming data from the device. Does not block. */
 int mctp_mmbi_poll(struct mctp_binding_mmbi *mmbi);
 
+/* The handle signalled by mctp_mmbi_notify(), for waiting on together with
+ * other sources. On Windows a device read completes on a separate event, so
+ * device mode outside pipeline mode should wait in mctp_mmbi_poll_wait(). */
+mctp_wait_handle_t mctp_mmbi_wait_handle(struct mctp_binding_mmbi *mmbi);
+
+/* Wake mctp_mmbi_poll_wait(). Call from another thread or an interrupt
+ * handler when the device can take more TX. Pipeline mode also calls it for
+ * each packet queued by mctp_mmbi_rx(). */
+void mctp_mmbi_notify(struct mctp_binding_mmbi *mmbi);
+
+/* Block for up to @timeout_ms, or forever if negative, until a device read
+ * completes or mctp_mmbi_notify() is called, then receive and resume the TX
+ * queue. In pipeline mode this runs mctp_mmbi_process() and leaves device
+ * reads to the I/O thread; otherwise it receives as mctp_mmbi_poll(). In
+ * memory mode outside pipeline mode, mctp_mmbi_rx() handles packets itself,
+ * so a wake only resumes TX. Returns 1 if woken or a packet was received, 0
+ * on timeout or a negative error. */
+int mctp_mmbi_poll_wait(struct mctp_binding_mmbi *mmbi, int timeout_ms);
+
+/* Hybrid polling. For @spin_us after mctp_mmbi_poll_wait() last found work,
+ * it busy-polls rather than blocking, to pick up a quick response without
+ * a scheduler wakeup. Past the window it blocks, using no CPU while idle.
+ * A @spin_us of 0, the default, always blocks.
+ */
+void mctp_mmbi_set_poll_policy(struct mctp_binding_mmbi *mmbi,
+			       uint32_t spin_us);
+void mctp_mmbi_get_poll_stats(struct mctp_binding_mmbi *mmbi,
+			      struct mctp_mmbi_poll_stats *stats);
+
+/* Pipeline mode. mctp_mmbi_poll() and mctp_mmbi_rx() only queue received
+ * packets, on a ring of @depth entries, so they can run on an I/O thread
+ * while a single protocol thread calls mctp_mmbi_process() to pass them
+ * to the core. Packets that arrive with the ring full are dropped and
+ * counted in rx_dropped.
+ *
+ * A @depth of 0 goes back to processing packets as they are read. Packets
+ * still queued when the mode is left or resized are passed to the core
+ * first, or dropped if the binding is not registered. The ring is
+ * replaced without synchronisation, so this must only be called while no
+ * I/O thread is running.
+ */
+int mctp_mmbi_set_pipeline(struct mctp_binding_mmbi *mmbi, size_t depth);
+
+/* Pass the queued packets to the core. Returns the number processed. */
+int mctp_mmbi_process(struct mctp_binding_mmbi *mmbi);
+
 /* 
  * --------------------------------------------------------------------------
  * High-Level "User Defined" API
@@ -74,6 +166,18 @@ void mctp_mmbi_set_debug(mctp_mmbi_context_t *ctx, bool enable);
 /* Poll for activity (calls rx_callback if data arrives) */
 int mctp_mmbi_context_poll(mctp_mmbi_context_t *ctx);
 
+/* Block until there is activity, see mctp_mmbi_poll_wait() */
+int mctp_mmbi_context_poll_wait(mctp_mmbi_context_t *ctx, int timeout_ms);
+
+/* Split polling into I/O and processing, see mctp_mmbi_set_pipeline().
+ * rx_callback is then called from mctp_mmbi_context_process(). */
+int mctp_mmbi_context_set_pipeline(mctp_mmbi_context_t *ctx, size_t depth);
+int mctp_mmbi_context_process(mctp_mmbi_context_t *ctx);
+
+/* Spin before blocking in poll_wait, see mctp_mmbi_set_poll_policy() */
+int mctp_mmbi_context_set_poll_policy(mctp_mmbi_context_t *ctx,
+				      uint32_t spin_us);
+
 #ifdef __cplusplus
 }
 #endif
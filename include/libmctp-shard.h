@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: Apache-2.0 OR GPL-2.0-or-later */
+
+#ifndef _LIBMCTP_SHARD_H
+#define _LIBMCTP_SHARD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libmctp.h>
+
+/* Shards are told apart by message tag, so there can be at most 8 */
+#define MCTP_SHARDS_MAX 8
+
+/*
+ * Sharded front end. Runs several independent struct mctp instances
+ * behind one binding, each driven by its own worker thread.
+ *
+ * Received packets are steered to shard (source EID + tag) % n. All the
+ * packets of a message therefore land on one shard, and its reassembly
+ * state stays local to one core. Each shard only allocates request tags
+ * that steer the response back to itself.
+ *
+ * @lower is the device binding, and is not registered with any struct
+ * mctp. The I/O code passes packets it receives to mctp_shard_rx() in
+ * place of mctp_bus_rx(). The shards transmit through lower->tx, one at
+ * a time.
+ *
+ * Threading: one I/O thread calls mctp_shard_rx(), and the worker thread
+ * of each shard calls mctp_shard_process() for it and uses its instance.
+ * Responses can be sent from any thread with mctp_shard_message_tx(), and
+ * mctp_shard_tx_ready() runs the TX queues of all shards from the caller's
+ * thread. So the core must be built with MCTP_THREAD_SAFE, and
+ * mctp_shard_init() fails without it.
+ *
+ * A Set Endpoint ID received by any shard changes the EID of all of them.
+ * Each shard takes up the new EID at the start of its next
+ * mctp_shard_process().
+ */
+struct mctp_shard_set;
+
+/* @n shards with local EID @eid, each queueing up to @depth received
+ * packets */
+struct mctp_shard_set *mctp_shard_init(struct mctp_binding *lower,
+				       mctp_eid_t eid, unsigned int n,
+				       size_t depth);
+void mctp_shard_destroy(struct mctp_shard_set *set);
+
+unsigned int mctp_shard_count(struct mctp_shard_set *set);
+
+/* The instance of shard @i, for setting its callbacks and sending from
+ * its worker thread */
+struct mctp *mctp_shard_mctp(struct mctp_shard_set *set, unsigned int i);
+
+/* The shard that owns messages from or to @eid with tag @tag */
+unsigned int mctp_shard_index(struct mctp_shard_set *set, mctp_eid_t eid,
+			      uint8_t tag);
+
+/* I/O thread: queue a received packet for its shard. The packet is
+ * copied, so remains the caller's. Returns -EBUSY if the shard's queue
+ * was full and the packet was dropped. */
+int mctp_shard_rx(struct mctp_shard_set *set, struct mctp_pktbuf *pkt);
+
+/* Worker thread of shard @i: pass its queued packets to its instance.
+ * Returns the number processed. */
+int mctp_shard_process(struct mctp_shard_set *set, unsigned int i);
+
+/* Send a message through the shard that owns (@eid, @msg_tag), as
+ * mctp_message_tx(). Used for responses from outside the worker thread. */
+int mctp_shard_message_tx(struct mctp_shard_set *set, mctp_eid_t eid,
+			  bool tag_owner, uint8_t msg_tag, const void *msg,
+			  size_t msg_len);
+
+/* The lower binding can transmit again after returning -EBUSY */
+void mctp_shard_tx_ready(struct mctp_shard_set *set);
+
+struct mctp_shard_stats {
+	/* Packets queued for the shard, and dropped as its queue was full */
+	uint64_t rx;
+	uint64_t dropped;
+};
+
+void mctp_shard_get_stats(struct mctp_shard_set *set, unsigned int i,
+			  struct mctp_shard_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBMCTP_SHARD_H */
@@ -38,6 +38,10 @@ struct mctp_hdr {
 #define MCTP_HDR_TAG_SHIFT (0)
 #define MCTP_HDR_TAG_MASK  (0x7)
 
+/* First byte of a message: integrity check flag and message type */
+#define MCTP_MSG_FLAG_IC   (1 << 7)
+#define MCTP_MSG_TYPE_MASK (0x7f)
+
 #define MCTP_MESSAGE_TO_SRC	      true
 #define MCTP_MESSAGE_TO_DST	      false
 #define MCTP_MESSAGE_CAPTURE_OUTGOING true
@@ -104,6 +108,20 @@ int mctp_setup(struct mctp *mctp, size_t struct_mctp_size);
 void mctp_cleanup(struct mctp *mctp);
 
 void mctp_set_max_message_size(struct mctp *mctp, size_t message_size);
+/* Set the initial allocation for multi-packet message reassembly. Buffers
+ * start at this size and grow geometrically as fragments arrive, with the
+ * max message size as a ceiling. Passing the max message size restores
+ * full-size allocation at start-of-message. */
+void mctp_set_reassembly_initial_size(struct mctp *mctp, size_t size);
+/* Set the reassembly timeout in milliseconds, 0 to disable. When all
+ * reassembly contexts are in use, a new message evicts a context that
+ * has been open for longer than this. Requires a clock, see
+ * mctp_set_now_op(). */
+void mctp_set_reassembly_timeout(struct mctp *mctp, uint64_t timeout_ms);
+/* When all reassembly contexts are in use and none has timed out, evict
+ * the least recently used one for a new message rather than dropping the
+ * new message. Disabled by default. */
+void mctp_set_reassembly_evict_lru(struct mctp *mctp, bool enable);
 typedef void (*mctp_capture_fn)(struct mctp_pktbuf *pkt, bool outgoing,
 				void *user);
 void mctp_set_capture_handler(struct mctp *mctp, mctp_capture_fn fn,
@@ -115,19 +133,35 @@ void mctp_set_capture_handler(struct mctp *mctp, mctp_capture_fn fn,
  * If this function is called, the MCTP stack is initialised as an 'endpoint',
  * and will deliver local packets to a RX callback - see `mctp_set_rx_all()`
  * below.
+ *
+ * Up to MCTP_MAX_BUSSES bindings can be registered, each with its own EID.
+ * Messages to any of those EIDs are local, whichever bus they arrive on.
+ * The first bus registered becomes the default route.
  */
 int mctp_register_bus(struct mctp *mctp, struct mctp_binding *binding,
 		      mctp_eid_t eid);
 
+/* Remove a bus, and the routes through it */
 void mctp_unregister_bus(struct mctp *mctp, struct mctp_binding *binding);
 
 int mctp_bus_set_eid(struct mctp_binding *binding, mctp_eid_t eid);
 
+/* Send messages for EIDs @first to @last through the bus of @binding, or
+ * remove their routes if @binding is NULL. Returns -EINVAL if @binding is
+ * not registered with @mctp. */
+int mctp_set_route(struct mctp *mctp, mctp_eid_t first, mctp_eid_t last,
+		   struct mctp_binding *binding);
+
+/* Send messages for EIDs without a route through the bus of @binding, or
+ * drop them if @binding is NULL */
+int mctp_set_default_route(struct mctp *mctp, struct mctp_binding *binding);
+
 /* Create a simple bidirectional bridge between busses.
  *
  * In this mode, the MCTP stack is initialised as a bridge. There is no EID
  * defined, so no packets are considered local. Instead, all messages from one
- * binding are forwarded to the other.
+ * binding are forwarded to the other, unless mctp_set_route() routes their
+ * destination back to the bus they arrived on.
  */
 int mctp_bridge_busses(struct mctp *mctp, struct mctp_binding *b1,
 		       struct mctp_binding *b2);
@@ -135,17 +169,80 @@ int mctp_bridge_busses(struct mctp *mctp, struct mctp_binding *b1,
 typedef void (*mctp_rx_fn)(uint8_t src_eid, bool tag_owner, uint8_t msg_tag,
 			   void *data, void *msg, size_t len);
 
+/* A contiguous region of a message */
+struct mctp_iovec {
+	const void *base;
+	size_t len;
+};
+
+/* Scatter-gather RX callback. The message is passed as @iovcnt regions,
+ * one per received fragment, totalling @len bytes. */
+typedef void (*mctp_rx_iov_fn)(uint8_t src_eid, bool tag_owner,
+			       uint8_t msg_tag, void *data,
+			       const struct mctp_iovec *iov, size_t iovcnt,
+			       size_t len);
+
+/* Set the message RX callback. The message buffer passed to the callback
+ * is only valid until it returns; single-packet messages are passed as a
+ * view into the received packet buffer. */
 int mctp_set_rx_all(struct mctp *mctp, mctp_rx_fn fn, void *data);
 
+/* Take ownership of the message being delivered to the RX callback, for
+ * callers that need to keep it after the callback returns. Only valid from
+ * within the callback. Reassembled messages are handed over without a copy,
+ * single-packet messages are copied. The returned buffer must be released
+ * with free(), or the custom mctp_set_alloc_ops() m_msg_free.
+ * Returns NULL outside a callback or on allocation failure.
+ */
+void *mctp_rx_msg_take(struct mctp *mctp);
+
+/* Streaming receive. A stream handler gets each message as a sequence of
+ * events: START, one DATA per in-order fragment, then END, or ABORT if
+ * the message is dropped part way through (sequence or size error,
+ * eviction, a restarted message, the handler being removed, or
+ * mctp_destroy()). Streamed messages are not buffered and not subject to
+ * the max message size. For DATA, @buf and @len describe the fragment
+ * payload, valid only until the handler returns. For END and ABORT, @buf
+ * is NULL and @len is the number of bytes delivered. */
+enum mctp_stream_event {
+	MCTP_STREAM_START,
+	MCTP_STREAM_DATA,
+	MCTP_STREAM_END,
+	MCTP_STREAM_ABORT,
+};
+
+typedef void (*mctp_stream_fn)(uint8_t src_eid, bool tag_owner,
+			       uint8_t msg_tag, void *data,
+			       enum mctp_stream_event event, const void *buf,
+			       size_t len);
+
+/* Wildcard message type or source EID for mctp_set_stream_handler() */
+#define MCTP_STREAM_ANY 0xff
+
+/* Stream messages of @msg_type from @src to @fn. Either may be
+ * MCTP_STREAM_ANY, and the most specific registered handler is used. A
+ * wildcard type does not match MCTP control messages. Registering an
+ * existing (@msg_type, @src) pair replaces its handler, and a NULL @fn
+ * removes it. Returns -ENOSPC when the handler table is full. */
+int mctp_set_stream_handler(struct mctp *mctp, uint8_t msg_type,
+			    mctp_eid_t src, mctp_stream_fn fn, void *data);
+
+/* Set a scatter-gather message RX callback, used in place of the
+ * mctp_set_rx_all() callback while set. Multi-packet messages are then
+ * kept as a chain of fragments instead of being copied into one flat
+ * buffer, and are passed to @fn as a list of regions that is only valid
+ * until it returns. mctp_rx_msg_take() returns a flat copy. */
+int mctp_set_rx_iov(struct mctp *mctp, mctp_rx_iov_fn fn, void *data);
+
 /* Transmit a message.
  * @msg: The message buffer to send. Must be suitable for
  * free(), or the custom mctp_set_alloc_ops() m_msg_free.
  * The mctp stack will take ownership of the buffer
  * and release it when message transmission is complete or fails.
  *
- * If an asynchronous binding is being used, it will return -EBUSY if
- * a message is already pending for transmission (msg will be freed as usual).
- * Asynchronous users can test mctp_is_tx_ready() prior to sending.
+ * Messages are queued per bus and sent as the binding accepts packets.
+ * If the queue is full, -EBUSY is returned (msg will be freed as usual).
+ * Callers can test mctp_is_tx_ready() prior to sending.
  */
 int mctp_message_tx_alloced(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
 			    uint8_t msg_tag, void *msg, size_t msg_len);
@@ -154,9 +251,8 @@ int mctp_message_tx_alloced(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
  * @msg: The message buffer to send. Ownership of this buffer
  * remains with the caller (a copy is made internally with __mctp_msg_alloc).
  *
- * If an asynchronous binding is being used, it will return -EBUSY if
- * a message is already pending for transmission.
- * Asynchronous users can test mctp_is_tx_ready() prior to sending.
+ * If the bus TX queue is full, -EBUSY is returned without making a copy.
+ * Callers can test mctp_is_tx_ready() prior to sending.
  *
  * This is equivalent to duplicating `msg` then calling mctp_message_tx_alloc().
  */
@@ -172,13 +268,143 @@ int mctp_message_tx(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
  * alloc_msg_tag may be NULL to ignore the returned tag.
  * If no tags are spare -EBUSY will be returned.
  *
- * If an asynchronous binding is being used, it will return -EBUSY if
- * a message is already pending for transmission (msg will be freed).
- * Asynchronous users can test mctp_is_tx_ready() prior to sending.
+ * If the bus TX queue is full, -EBUSY is returned and no tag is allocated
+ * (msg will be freed).
+ * Callers can test mctp_is_tx_ready() prior to sending.
  */
 int mctp_message_tx_request(struct mctp *mctp, mctp_eid_t eid, void *msg,
 			    size_t msg_len, uint8_t *alloc_msg_tag);
 
+/* Called with the response to a request sent by
+ * mctp_message_tx_request_cb(). @status is 0 with the response in @msg,
+ * which is only valid until the callback returns (see mctp_rx_msg_take()).
+ * Otherwise @msg is NULL and @status is -ETIMEDOUT if the request tag
+ * expired first, -ECANCELED if the bus was unregistered, -EHOSTUNREACH if
+ * there is no bus for @eid, or -ENOMEM. */
+typedef void (*mctp_resp_fn)(mctp_eid_t eid, uint8_t msg_tag, int status,
+			     void *msg, size_t len, void *data);
+
+/* Transmit a request message as mctp_message_tx_request(), and pass the
+ * response to @fn in place of the mctp_set_rx_all() callback. @fn is
+ * called exactly once for every request this returns 0 for.
+ *
+ * If all tags to @eid are in use, the request is held and sent once a
+ * response or timeout frees one. @alloc_msg_tag is then set to
+ * MCTP_TAG_PENDING, and the tag is only passed to @fn. -EBUSY is returned
+ * if the pending queue is full. */
+int mctp_message_tx_request_cb(struct mctp *mctp, mctp_eid_t eid, void *msg,
+			       size_t msg_len, uint8_t *alloc_msg_tag,
+			       mctp_resp_fn fn, void *data);
+
+#define MCTP_TAG_PENDING 0xff
+
+/* Limit the requests held by mctp_message_tx_request_cb() waiting for a
+ * tag to @depth, across all peers. 0 disables holding requests. */
+void mctp_set_request_queue_limit(struct mctp *mctp, size_t depth);
+
+struct mctp_req_stats {
+	/* Requests waiting for a tag */
+	size_t pending;
+	/* Most requests waiting at once */
+	size_t max_pending;
+	/* Requests that had to wait, and that were refused with -EBUSY as
+	 * the queue was full */
+	uint64_t queued;
+	uint64_t rejected;
+};
+
+void mctp_get_request_stats(struct mctp *mctp, struct mctp_req_stats *stats);
+
+/* Only allocate request tags to @eid that @fn returns true for, so that
+ * the responses can be steered back to the sender, as by libmctp-shard.h.
+ * Set @fn to NULL to allow all tags. */
+typedef bool (*mctp_tag_filter_fn)(mctp_eid_t eid, uint8_t tag, void *data);
+void mctp_set_tag_filter(struct mctp *mctp, mctp_tag_filter_fn fn,
+			 void *data);
+
+/* Expire request tags that have passed their timeout, calling the response
+ * callbacks of their requests. Call periodically when using response
+ * callbacks, tags are otherwise only expired as new ones are allocated. */
+void mctp_check_timeouts(struct mctp *mctp);
+
+/* Outbound message priority classes. Each bus queues the classes
+ * separately, and urgent messages are sent ahead of bulk ones. MCTP
+ * control messages are always urgent. */
+enum mctp_tx_class {
+	MCTP_TX_CLASS_BULK = 0,
+	MCTP_TX_CLASS_URGENT,
+};
+
+/* Called once a message sent with mctp_message_tx_opts() is finished with.
+ * @status is 0 once every packet has been accepted by the binding, or the
+ * binding's error if the rest of the message was dropped, -ECANCELED if
+ * the bus was unregistered first, or -EHOSTUNREACH if there is no bus for
+ * the destination. @sent is the message bytes accepted
+ * by the binding, and @elapsed the milliseconds since the message was
+ * queued, 0 without a clock (mctp_set_now_op()). The callback may queue
+ * new messages. */
+typedef void (*mctp_tx_done_fn)(int status, size_t sent, uint64_t elapsed,
+				void *data);
+
+/* Options for mctp_message_tx_opts() */
+struct mctp_tx_opts {
+	enum mctp_tx_class tx_class;
+	/* Completion callback, may be NULL */
+	mctp_tx_done_fn done;
+	void *done_data;
+};
+
+/* Transmit a message as mctp_message_tx_alloced(), with @opts applied.
+ * @opts may be NULL for the defaults.
+ *
+ * If a completion callback is set, it is called for every message this
+ * returns 0 for. Messages refused with an error are not reported.
+ */
+int mctp_message_tx_opts(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
+			 uint8_t msg_tag, void *msg, size_t msg_len,
+			 const struct mctp_tx_opts *opts);
+
+/* Transmit a message without copying it.
+ * @msg: The message buffer to send. Ownership of this buffer remains with
+ * the caller, which must keep it unchanged until the completion callback
+ * of @opts is called. @opts and its callback are required.
+ *
+ * If the binding sends the whole message at once, the callback is called
+ * before this returns. On an error return the callback is not called and
+ * the buffer can be reused straight away.
+ */
+int mctp_message_tx_borrowed(struct mctp *mctp, mctp_eid_t eid,
+			     bool tag_owner, uint8_t msg_tag, const void *msg,
+			     size_t msg_len, const struct mctp_tx_opts *opts);
+
+/* Transmit a message held in @iovcnt regions, sent one after the other.
+ * Packets are built straight from the regions, which are borrowed as for
+ * mctp_message_tx_borrowed(). The @iov array itself is copied.
+ */
+int mctp_message_tx_iov(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
+			uint8_t msg_tag, const struct mctp_iovec *iov,
+			size_t iovcnt, const struct mctp_tx_opts *opts);
+
+/* Limit each bus TX queue to @depth messages and @bytes of message data.
+ * A message is always accepted onto an empty queue. Applies to the bulk
+ * class. */
+void mctp_set_tx_queue_limits(struct mctp *mctp, size_t depth, size_t bytes);
+
+/* Limit the urgent class of each bus TX queue to @depth messages and @bytes
+ * of message data. While bulk messages are waiting, one bulk packet is
+ * sent after each @max_run urgent packets. */
+void mctp_set_tx_urgent_limits(struct mctp *mctp, size_t depth, size_t bytes,
+			       size_t max_run);
+
+/* Interleave the packets of up to @max_inflight queued messages per bus,
+ * taking turns round-robin with @burst packets per turn. Messages with the
+ * same source, destination and tag are still sent one after the other.
+ * @max_inflight of 1 sends messages strictly in order. */
+void mctp_set_tx_interleave(struct mctp *mctp, size_t max_inflight,
+			    size_t burst);
+
+/* Returns true if the TX queue of the bus for @eid has room for another
+ * bulk message */
 bool mctp_is_tx_ready(struct mctp *mctp, mctp_eid_t eid);
 
 /* hardware bindings */
@@ -191,6 +417,17 @@ bool mctp_is_tx_ready(struct mctp *mctp, mctp_eid_t eid);
  *      * 0 - Success, pktbuf can be released
  *	* -EMSGSIZE - Packet exceeds binding MTU, pktbuf must be dropped
  *	* -EBUSY - Packet unable to be transmitted, pktbuf must be retained
+ * @tx_gather: Optional. Transmit one packet given as its MCTP header and a
+ * payload region that points into the message being sent, so that the
+ * binding can write both out in a single pass without the payload first
+ * being copied to tx_storage. Returns as for @tx. Used in place of @tx
+ * unless a capture handler is set.
+ * @tx_batch: Optional. Transmit @n packets in one call. Returns the number
+ * of packets taken, in order, or a negative error as for @tx if none were.
+ * Returning fewer than @n is treated as -EBUSY for the rest. Used in place
+ * of @tx and @tx_gather, except while storage for a batch can't be
+ * allocated, when packets go through @tx if set.
+ * @tx_batch_max: Maximum packets per @tx_batch call, 0 for the default.
  */
 struct mctp_binding {
 	const char *name;
@@ -203,10 +440,19 @@ struct mctp_binding {
 	void *tx_storage;
 	int (*start)(struct mctp_binding *binding);
 	int (*tx)(struct mctp_binding *binding, struct mctp_pktbuf *pkt);
+	int (*tx_gather)(struct mctp_binding *binding,
+			 const struct mctp_hdr *hdr, const void *payload,
+			 size_t len);
+	int (*tx_batch)(struct mctp_binding *binding,
+			struct mctp_pktbuf *const *pkts, size_t n);
+	size_t tx_batch_max;
 	mctp_rx_fn control_rx;
 	void *control_rx_data;
 };
 
+/* Enable or disable transmission on a binding. Enabling an already enabled
+ * binding resumes draining the TX queue, for bindings that returned -EBUSY
+ * from tx() and are now ready. */
 void mctp_binding_set_tx_enabled(struct mctp_binding *binding, bool enable);
 
 /*
@@ -7,10 +7,24 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* An event HANDLE on Windows, or a file descriptor to poll() for reading */
+#ifndef MCTP_WAIT_HANDLE_DEFINED
+#define MCTP_WAIT_HANDLE_DEFINED
+#ifdef _WIN32
+typedef HANDLE mctp_wait_handle_t;
+#else
+typedef int mctp_wait_handle_t;
+#endif
+#endif
+
 typedef struct mctp_transport mctp_transport_t;
 
 /* Callback function prototype for received messages */
@@ -62,6 +76,25 @@ int mctp_transport_send(mctp_transport_t *ctx, uint8_t dst_eid, const void *data
  */
 int mctp_transport_poll(mctp_transport_t *ctx);
 
+/**
+ * @brief Block until the transport has incoming data or TX room, then poll it.
+ * Replaces calling mctp_transport_poll() in a loop with a sleep.
+ * 
+ * @param ctx The transport context.
+ * @param timeout_ms How long to wait, or negative to wait forever.
+ * @return int 1 if woken, 0 on timeout, negative on error.
+ */
+int mctp_transport_poll_wait(mctp_transport_t *ctx, int timeout_ms);
+
+/**
+ * @brief Get the handle signalled when mctp_transport_poll_wait() would have
+ * work, to wait on together with other sources in an application's own loop.
+ * 
+ * @param ctx The transport context.
+ * @return mctp_wait_handle_t An event HANDLE on Windows, or a file descriptor.
+ */
+mctp_wait_handle_t mctp_transport_get_wait_handle(mctp_transport_t *ctx);
+
 #ifdef __cplusplus
 }
 #endif
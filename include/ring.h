@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: Apache-2.0 OR GPL-2.0-or-later */
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MCTP_RING_CACHELINE 64
+
+/*
+ * Lock-free ring of pointers between one producer thread and one consumer
+ * thread. Each index is only written by one side, and they are kept on
+ * separate cache lines so that the two threads don't contend for them.
+ */
+struct mctp_ring {
+	void **slots;
+	size_t mask;
+	char pad0[MCTP_RING_CACHELINE];
+	/* Next slot to pop, written by the consumer */
+	size_t head;
+	char pad1[MCTP_RING_CACHELINE];
+	/* Next slot to push, written by the producer */
+	size_t tail;
+	char pad2[MCTP_RING_CACHELINE];
+};
+
+/* @size is rounded up to a power of two */
+int mctp_ring_init(struct mctp_ring *ring, size_t size);
+void mctp_ring_destroy(struct mctp_ring *ring);
+
+/* Producer side. Returns false if the ring is full. */
+bool mctp_ring_push(struct mctp_ring *ring, void *item);
+
+/* Consumer side. Returns NULL if the ring is empty. */
+void *mctp_ring_pop(struct mctp_ring *ring);
+
+/* Number of items in the ring, which may be stale by the time it is used */
+size_t mctp_ring_count(struct mctp_ring *ring);
+
+#endif
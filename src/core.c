@@ -31,9 +31,34 @@
 
 static int mctp_message_tx_on_bus(struct mctp_bus *bus, mctp_eid_t src,
 				  mctp_eid_t dest, bool tag_owner,
-				  uint8_t msg_tag, void *msg, size_t msg_len);
-static void mctp_dealloc_tag(struct mctp_bus *bus, mctp_eid_t local,
-			     mctp_eid_t remote, uint8_t tag);
+				  uint8_t msg_tag, const struct mctp_iovec *iov,
+				  size_t iovcnt, void *msg,
+				  const struct mctp_tx_opts *opts,
+				  const struct mctp_tx_cont *cont);
+static void mctp_tx_msg_done(struct mctp_bus *bus, struct mctp_tx_msg *tx,
+			     int status);
+static mctp_resp_fn mctp_dealloc_tag(struct mctp_bus *bus, mctp_eid_t local,
+				     mctp_eid_t remote, uint8_t tag,
+				     void **data);
+static struct mctp_req_tag *mctp_req_tag_lookup(struct mctp *mctp,
+						mctp_eid_t local,
+						mctp_eid_t remote,
+						uint8_t tag);
+static void mctp_req_tag_fail(struct mctp *mctp, uint16_t idx, int status);
+static void mctp_req_pending_run(struct mctp *mctp);
+static void mctp_req_pending_cancel(struct mctp *mctp, struct mctp_bus *bus);
+static int mctp_packet_tx(struct mctp_bus *bus, struct mctp_pktbuf *pkt);
+
+/*
+ * With MCTP_THREAD_SAFE, one thread can transmit while another receives.
+ * Reassembly, the request tags and each bus TX queue have their own lock,
+ * always taken in that order: rx_lock, tag_lock, then tx_lock. Callbacks
+ * may call back into the core, so the locks are recursive. Binding TX
+ * calls from the TX queue and TX completion callbacks run with no TX lock
+ * held, and held requests are sent with no tag lock held. Bridged packets are forwarded under it, so a binding that passes
+ * transmitted packets back to mctp_bus_rx() from its tx call reverses the
+ * order, and must only be used from one thread.
+ */
 
 struct mctp_pktbuf *mctp_pktbuf_alloc(struct mctp_binding *binding, size_t len)
 {
@@ -152,80 +177,619 @@ static void *mctp_msg_dup(const void *msg, size_t msg_len, struct mctp *mctp)
 }
 
 /* Message reassembly */
+
+/* Contexts are indexed by an open-addressed hash of (src, dest, tag), with
+ * linear probing. Table entries hold the msg_ctxs[] index plus one, so zero
+ * is an empty bucket. */
+static unsigned int mctp_msg_ctx_hash(uint8_t src, uint8_t dest, uint8_t tag)
+{
+	uint32_t key = (uint32_t)src << 16 | (uint32_t)dest << 8 | tag;
+
+	key *= 2654435761u;
+	key ^= key >> 16;
+	return key % MCTP_REASSEMBLY_HASH_SIZE;
+}
+
+static inline bool mctp_msg_ctx_match(const struct mctp_msg_ctx *ctx,
+				      uint8_t src, uint8_t dest, uint8_t tag)
+{
+	return ctx->in_use && ctx->src == src && ctx->dest == dest &&
+	       ctx->tag == tag;
+}
+
 static struct mctp_msg_ctx *mctp_msg_ctx_lookup(struct mctp *mctp, uint8_t src,
 						uint8_t dest, uint8_t tag)
 {
+	struct mctp_msg_ctx *ctx;
 	unsigned int i;
 
-	/* @todo: better lookup, if we add support for more outstanding
-	 * message contexts */
-	for (i = 0; i < ARRAY_SIZE(mctp->msg_ctxs); i++) {
-		struct mctp_msg_ctx *ctx = &mctp->msg_ctxs[i];
-		if (ctx->buf && ctx->src == src && ctx->dest == dest &&
-		    ctx->tag == tag)
+	/* Middle fragments of a message usually arrive back to back */
+	ctx = mctp->msg_ctx_last;
+	if (ctx && mctp_msg_ctx_match(ctx, src, dest, tag))
+		return ctx;
+
+	for (i = mctp_msg_ctx_hash(src, dest, tag); mctp->msg_ctx_index[i];
+	     i = (i + 1) % MCTP_REASSEMBLY_HASH_SIZE) {
+		ctx = &mctp->msg_ctxs[mctp->msg_ctx_index[i] - 1];
+		if (mctp_msg_ctx_match(ctx, src, dest, tag)) {
+			mctp->msg_ctx_last = ctx;
 			return ctx;
+		}
 	}
 
 	return NULL;
 }
 
-static struct mctp_msg_ctx *mctp_msg_ctx_create(struct mctp *mctp, uint8_t src,
-						uint8_t dest, uint8_t tag)
+static void mctp_msg_ctx_index_add(struct mctp *mctp, struct mctp_msg_ctx *ctx)
 {
-	struct mctp_msg_ctx *ctx = NULL;
 	unsigned int i;
 
-	for (i = 0; i < ARRAY_SIZE(mctp->msg_ctxs); i++) {
-		struct mctp_msg_ctx *tmp = &mctp->msg_ctxs[i];
-		if (!tmp->buf) {
-			ctx = tmp;
-			break;
-		}
+	for (i = mctp_msg_ctx_hash(ctx->src, ctx->dest, ctx->tag);
+	     mctp->msg_ctx_index[i]; i = (i + 1) % MCTP_REASSEMBLY_HASH_SIZE)
+		;
+
+	mctp->msg_ctx_index[i] = (uint16_t)(ctx - mctp->msg_ctxs) + 1;
+}
+
+static void mctp_msg_ctx_index_remove(struct mctp *mctp,
+				      struct mctp_msg_ctx *ctx)
+{
+	uint16_t entry = (uint16_t)(ctx - mctp->msg_ctxs) + 1;
+	unsigned int i, j, home;
+
+	for (i = mctp_msg_ctx_hash(ctx->src, ctx->dest, ctx->tag);
+	     mctp->msg_ctx_index[i] != entry;
+	     i = (i + 1) % MCTP_REASSEMBLY_HASH_SIZE)
+		assert(mctp->msg_ctx_index[i]);
+
+	/* Backward-shift deletion: move later entries of the probe run into
+	 * the hole, unless that would place them before their home bucket */
+	for (j = (i + 1) % MCTP_REASSEMBLY_HASH_SIZE; mctp->msg_ctx_index[j];
+	     j = (j + 1) % MCTP_REASSEMBLY_HASH_SIZE) {
+		struct mctp_msg_ctx *tmp =
+			&mctp->msg_ctxs[mctp->msg_ctx_index[j] - 1];
+
+		home = mctp_msg_ctx_hash(tmp->src, tmp->dest, tmp->tag);
+		if (i <= j ? (i < home && home <= j) :
+			     (i < home || home <= j))
+			continue;
+
+		mctp->msg_ctx_index[i] = mctp->msg_ctx_index[j];
+		i = j;
+	}
+
+	mctp->msg_ctx_index[i] = 0;
+}
+
+static void mctp_msg_ctx_free_frags(struct mctp *mctp,
+				    struct mctp_msg_ctx *ctx)
+{
+	struct mctp_msg_frag *frag, *next;
+
+	for (frag = ctx->frags; frag; frag = next) {
+		next = frag->next;
+		__mctp_msg_free(frag, mctp);
+	}
+	ctx->frags = NULL;
+	ctx->frags_tail = NULL;
+	ctx->n_frags = 0;
+}
+
+static void mctp_msg_ctx_stream(struct mctp_msg_ctx *ctx,
+				enum mctp_stream_event event, const void *buf,
+				size_t len)
+{
+	struct mctp_stream_handler *h = ctx->stream;
+
+	h->fn(ctx->src, ctx->tag_owner, ctx->tag, h->data, event, buf, len);
+}
+
+static void mctp_msg_ctx_drop(struct mctp *mctp, struct mctp_msg_ctx *ctx)
+{
+	/* A stream still attached here did not complete */
+	if (ctx->stream) {
+		mctp_msg_ctx_stream(ctx, MCTP_STREAM_ABORT, NULL,
+				    ctx->buf_size);
+		ctx->stream = NULL;
+	}
+
+	mctp_msg_ctx_index_remove(mctp, ctx);
+	if (mctp->msg_ctx_last == ctx)
+		mctp->msg_ctx_last = NULL;
+	mctp->msg_ctx_free[mctp->n_msg_ctx_free++] =
+		(uint16_t)(ctx - mctp->msg_ctxs);
+
+	/* Free and mark as unused. buf may have been handed to the
+	 * application by mctp_rx_msg_take() */
+	if (ctx->buf)
+		__mctp_msg_free(ctx->buf, mctp);
+	ctx->buf = NULL;
+	mctp_msg_ctx_free_frags(mctp, ctx);
+	ctx->in_use = false;
+}
+
+/* A context is stale once it has been open for longer than the reassembly
+ * timeout. Without a clock, or with the timeout disabled, nothing is. */
+static bool mctp_msg_ctx_is_stale(struct mctp *mctp,
+				  const struct mctp_msg_ctx *ctx, uint64_t now)
+{
+	if (!mctp->platform_now || !mctp->reassembly_timeout)
+		return false;
+
+	return now - ctx->start >= mctp->reassembly_timeout;
+}
+
+/* Free up a context slot for a new message: the least recently used stale
+ * context is dropped, or if there is none and LRU eviction is enabled, the
+ * least recently used context. */
+static void mctp_msg_ctx_evict(struct mctp *mctp, uint64_t now)
+{
+	struct mctp_msg_ctx *ctx, *lru = NULL, *stale = NULL;
+	size_t i;
+
+	for (i = 0; i < MCTP_REASSEMBLY_CTXS; i++) {
+		ctx = &mctp->msg_ctxs[i];
+		if (!ctx->in_use)
+			continue;
+
+		if (!lru || ctx->last_used < lru->last_used)
+			lru = ctx;
+
+		if (mctp_msg_ctx_is_stale(mctp, ctx, now) &&
+		    (!stale || ctx->last_used < stale->last_used))
+			stale = ctx;
 	}
 
+	ctx = stale ? stale : mctp->reassembly_evict_lru ? lru : NULL;
 	if (!ctx)
+		return;
+
+	mctp_prdebug("evicting %s reassembly context src %d dest %d tag %d",
+		     ctx == stale ? "stale" : "LRU", ctx->src, ctx->dest,
+		     ctx->tag);
+	mctp_msg_ctx_drop(mctp, ctx);
+}
+
+static struct mctp_msg_ctx *
+mctp_msg_ctx_create(struct mctp *mctp, uint8_t src, uint8_t dest, uint8_t tag,
+		    bool tag_owner, size_t first_len,
+		    struct mctp_stream_handler *stream, struct mctp_bus *fwd)
+{
+	struct mctp_msg_ctx *ctx;
+	uint64_t now = 0;
+
+	if (mctp->platform_now)
+		now = mctp_now(mctp);
+
+	if (!mctp->n_msg_ctx_free)
+		mctp_msg_ctx_evict(mctp, now);
+
+	if (!mctp->n_msg_ctx_free)
 		return NULL;
 
+	ctx = &mctp->msg_ctxs[mctp->msg_ctx_free[mctp->n_msg_ctx_free - 1]];
+
 	ctx->src = src;
 	ctx->dest = dest;
 	ctx->tag = tag;
+	ctx->tag_owner = tag_owner;
 
 	ctx->buf_size = 0;
-	ctx->buf_alloc_size = mctp->max_message_size;
-	ctx->buf = __mctp_msg_alloc(ctx->buf_alloc_size, mctp);
-	if (!ctx->buf) {
-		return NULL;
+	ctx->frags = NULL;
+	ctx->frags_tail = NULL;
+	ctx->n_frags = 0;
+
+	/* Streamed and cut-through messages are passed on fragment by
+	 * fragment, scatter-gather receivers get the fragment chain,
+	 * otherwise reassemble into a flat buffer */
+	ctx->stream = NULL;
+	ctx->fwd = fwd;
+	ctx->fwd_held = false;
+	ctx->chain = !stream && mctp->message_rx_iov &&
+		     mctp->route_policy == ROUTE_ENDPOINT;
+	if (stream || fwd || ctx->chain) {
+		ctx->buf = NULL;
+		ctx->buf_alloc_size = 0;
+	} else {
+		/* Start with room for at least the first fragment */
+		ctx->buf_alloc_size =
+			MIN(MAX(mctp->reassembly_initial_size, first_len),
+			    mctp->max_message_size);
+		ctx->buf = __mctp_msg_alloc(ctx->buf_alloc_size, mctp);
+		if (!ctx->buf) {
+			return NULL;
+		}
+	}
+
+	ctx->in_use = true;
+	ctx->start = now;
+	mctp->n_msg_ctx_free--;
+	mctp_msg_ctx_index_add(mctp, ctx);
+	mctp->msg_ctx_last = ctx;
+
+	if (stream) {
+		ctx->stream = stream;
+		mctp_msg_ctx_stream(ctx, MCTP_STREAM_START, NULL, 0);
 	}
 
 	return ctx;
 }
 
-static void mctp_msg_ctx_drop(struct mctp_bus *bus, struct mctp_msg_ctx *ctx)
+static void mctp_msg_ctx_reset(struct mctp *mctp, struct mctp_msg_ctx *ctx)
 {
-	/* Free and mark as unused */
-	__mctp_msg_free(ctx->buf, bus->mctp);
-	ctx->buf = NULL;
+	mctp_msg_ctx_free_frags(mctp, ctx);
+	ctx->buf_size = 0;
+	ctx->fragment_size = 0;
+	if (mctp->platform_now)
+		ctx->start = mctp_now(mctp);
 }
 
-static void mctp_msg_ctx_reset(struct mctp_msg_ctx *ctx)
+/* Grow a reassembly buffer to hold at least @size bytes. The allocation
+ * doubles each time so that the number of grow copies stays logarithmic in
+ * the message size, and is capped at max_message_size. */
+static int mctp_msg_ctx_grow(struct mctp *mctp, struct mctp_msg_ctx *ctx,
+			     size_t size)
 {
-	ctx->buf_size = 0;
-	ctx->fragment_size = 0;
+	size_t alloc_size;
+	void *buf;
+
+	if (size > mctp->max_message_size) {
+		mctp_prdebug("message exceeds max size %zu",
+			     mctp->max_message_size);
+		return -1;
+	}
+
+	alloc_size = MAX(ctx->buf_alloc_size, (size_t)1);
+	while (alloc_size < size) {
+		if (alloc_size > mctp->max_message_size / 2) {
+			alloc_size = mctp->max_message_size;
+			break;
+		}
+		alloc_size *= 2;
+	}
+
+	buf = __mctp_msg_alloc(alloc_size, mctp);
+	if (!buf) {
+		mctp_prdebug("reassembly grow to %zu failed", alloc_size);
+		return -1;
+	}
+
+	memcpy(buf, ctx->buf, ctx->buf_size);
+	__mctp_msg_free(ctx->buf, mctp);
+	ctx->buf = buf;
+	ctx->buf_alloc_size = alloc_size;
+
+	return 0;
+}
+
+/* Append a fragment to the chain. The packet buffer belongs to the binding,
+ * so the payload is copied once into a node sized to fit it. */
+static int mctp_msg_ctx_add_frag(struct mctp *mctp, struct mctp_msg_ctx *ctx,
+				 const void *data, size_t len)
+{
+	struct mctp_msg_frag *frag;
+
+	frag = __mctp_msg_alloc(sizeof(*frag) + len, mctp);
+	if (!frag) {
+		mctp_prdebug("fragment alloc %zu failed", len);
+		return -1;
+	}
+
+	frag->next = NULL;
+	frag->len = len;
+	memcpy(frag->data, data, len);
+
+	if (ctx->frags_tail)
+		ctx->frags_tail->next = frag;
+	else
+		ctx->frags = frag;
+	ctx->frags_tail = frag;
+	ctx->n_frags++;
+
+	return 0;
+}
+
+/* Send a received packet on the bridge egress bus @egress, unchanged. It is
+ * passed on in place if the ingress buffer has the header and trailer room
+ * the egress binding needs, otherwise it is copied to the egress TX
+ * storage. */
+static int mctp_bridge_tx_pkt(struct mctp_bus *egress, struct mctp_pktbuf *pkt)
+{
+	struct mctp_binding *binding = egress->binding;
+	size_t len = mctp_pktbuf_size(pkt);
+	struct mctp_pktbuf *out = pkt;
+	int rc;
+
+	mctp_lock(&egress->tx_lock);
+
+	/* tx_storage may be holding a packet of a send in progress */
+	if (egress->state != mctp_bus_state_tx_enabled || egress->tx_active) {
+		mctp_unlock(&egress->tx_lock);
+		return -EBUSY;
+	}
+
+	if (pkt->start < binding->pkt_header ||
+	    pkt->size - pkt->end < binding->pkt_trailer) {
+		out = mctp_pktbuf_init(binding, binding->tx_storage);
+		memcpy(mctp_pktbuf_hdr(out), mctp_pktbuf_hdr(pkt), len);
+		out->end = out->start + len;
+	}
+
+	rc = mctp_packet_tx(egress, out);
+	mctp_unlock(&egress->tx_lock);
+	return rc;
+}
+
+/* The bus to forward a message arriving on @bus for @dest to packet by
+ * packet, or NULL if it must be reassembled first. That is when the
+ * egress can't send now, or has messages queued that the new one must not
+ * overtake. */
+static struct mctp_bus *mctp_bridge_cut_through(struct mctp_bus *bus,
+						mctp_eid_t dest)
+{
+	struct mctp *mctp = bus->mctp;
+	struct mctp_bus *egress;
+	uint8_t route;
+	bool idle;
+
+	if (mctp->route_policy != ROUTE_BRIDGE)
+		return NULL;
+
+	route = mctp->routes[dest];
+	if (route)
+		egress = &mctp->busses[route - 1];
+	else if (mctp->n_busses == 2)
+		egress = &mctp->busses[bus == &mctp->busses[0]];
+	else
+		return NULL;
+
+	if (egress == bus)
+		return NULL;
+
+	mctp_lock(&egress->tx_lock);
+	idle = egress->state == mctp_bus_state_tx_enabled &&
+	       !egress->tx_active &&
+	       !egress->tx_queues[MCTP_TX_CLASS_URGENT].head &&
+	       !egress->tx_queues[MCTP_TX_CLASS_BULK].head;
+	mctp_unlock(&egress->tx_lock);
+
+	return idle ? egress : NULL;
+}
+
+/* Empty the egress packet of a re-sliced flow, leaving room for its
+ * header */
+static void mctp_bridge_flow_reset(struct mctp_msg_ctx *ctx)
+{
+	struct mctp_pktbuf *pkt;
+
+	pkt = mctp_pktbuf_init(ctx->fwd->binding, ctx->buf);
+	pkt->end = pkt->start + sizeof(struct mctp_hdr);
+}
+
+/* Re-slice a message arriving on @bus if its egress has another packet
+ * size. Payload is gathered into one egress packet at a time, so larger
+ * ingress packets are split and smaller ones coalesced. */
+static int mctp_bridge_flow_start(struct mctp *mctp, struct mctp_bus *bus,
+				  struct mctp_msg_ctx *ctx)
+{
+	struct mctp_binding *binding = ctx->fwd->binding;
+	size_t size;
+
+	if (binding->pkt_size == bus->binding->pkt_size)
+		return 0;
+
+	size = MCTP_PKTBUF_SIZE(binding->pkt_size + binding->pkt_header +
+				binding->pkt_trailer);
+	ctx->buf = __mctp_msg_alloc(size, mctp);
+	if (!ctx->buf)
+		return -ENOMEM;
+
+	ctx->buf_alloc_size = size;
+	ctx->fwd_pos = 0;
+	ctx->fwd_seq = 0;
+	mctp_bridge_flow_reset(ctx);
+	return 0;
+}
+
+/* Send the egress packet gathered for @ctx, numbered in the egress
+ * sequence of the flow */
+static int mctp_bridge_flow_send(struct mctp_msg_ctx *ctx, bool eom)
+{
+	struct mctp_pktbuf *pkt = ctx->buf;
+	struct mctp_hdr *hdr = mctp_pktbuf_hdr(pkt);
+	size_t len = mctp_pktbuf_size(pkt) - sizeof(*hdr);
+	uint8_t flags_seq_tag;
+	int rc;
+
+	hdr->ver = ctx->fwd->binding->version & 0xf;
+	hdr->dest = ctx->dest;
+	hdr->src = ctx->src;
+	flags_seq_tag = (ctx->tag_owner << MCTP_HDR_TO_SHIFT) |
+			(ctx->tag << MCTP_HDR_TAG_SHIFT) |
+			(ctx->fwd_seq << MCTP_HDR_SEQ_SHIFT);
+	if (ctx->fwd_pos == 0)
+		flags_seq_tag |= MCTP_HDR_FLAG_SOM;
+	if (eom)
+		flags_seq_tag |= MCTP_HDR_FLAG_EOM;
+	hdr->flags_seq_tag = flags_seq_tag;
+
+	rc = mctp_bridge_tx_pkt(ctx->fwd, pkt);
+	if (rc)
+		return rc;
+
+	ctx->fwd_pos += len;
+	ctx->fwd_seq = (ctx->fwd_seq + 1) & MCTP_HDR_SEQ_MASK;
+	mctp_bridge_flow_reset(ctx);
+	return 0;
+}
+
+/* Hold @len bytes of payload at @data that the egress of @ctx was too
+ * busy for, to queue at EOM */
+static int mctp_bridge_flow_hold(struct mctp *mctp, struct mctp_msg_ctx *ctx,
+				 const void *data, size_t len)
+{
+	if (ctx->buf_size - ctx->fwd_pos > mctp->max_message_size) {
+		mctp_prdebug("message exceeds max size %zu",
+			     mctp->max_message_size);
+		return -1;
+	}
+
+	ctx->fwd_held = true;
+	if (!len)
+		return 0;
+	return mctp_msg_ctx_add_frag(mctp, ctx, data, len);
+}
+
+/* Hold the egress packet gathered for @ctx, and any payload after it */
+static int mctp_bridge_flow_hold_pkt(struct mctp *mctp,
+				     struct mctp_msg_ctx *ctx,
+				     const uint8_t *data, size_t len)
+{
+	struct mctp_pktbuf *pkt = ctx->buf;
+	int rc;
+
+	rc = mctp_bridge_flow_hold(mctp, ctx, mctp_pktbuf_data(pkt),
+				   mctp_pktbuf_size(pkt) -
+					   sizeof(struct mctp_hdr));
+	if (!rc && len)
+		rc = mctp_msg_ctx_add_frag(mctp, ctx, data, len);
+	return rc;
+}
+
+/* Add payload to the flow of @ctx. A full egress packet is only sent once
+ * more payload follows, so that the last one can carry EOM. */
+static int mctp_bridge_flow_add(struct mctp *mctp, struct mctp_msg_ctx *ctx,
+				const uint8_t *data, size_t len)
+{
+	size_t body = MCTP_BODY_SIZE(ctx->fwd->binding->pkt_size);
+	struct mctp_pktbuf *pkt = ctx->buf;
+	size_t fill, n;
+	int rc;
+
+	while (len) {
+		fill = mctp_pktbuf_size(pkt) - sizeof(struct mctp_hdr);
+		if (fill == body) {
+			rc = mctp_bridge_flow_send(ctx, false);
+			if (rc == -EBUSY)
+				return mctp_bridge_flow_hold_pkt(mctp, ctx,
+								 data, len);
+			if (rc)
+				return rc;
+			continue;
+		}
+
+		n = MIN(len, body - fill);
+		memcpy(pkt->data + pkt->end, data, n);
+		pkt->end += n;
+		data += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Finish a cut-through message at EOM. The last egress packet of a
+ * re-sliced flow is sent, and whatever the egress was too busy for is
+ * queued on it to continue the message. */
+static int mctp_bridge_flow_end(struct mctp *mctp, struct mctp_msg_ctx *ctx)
+{
+	struct mctp_msg_frag *frag;
+	struct mctp_tx_cont cont;
+	struct mctp_iovec iov;
+	uint8_t *msg, *p;
+	size_t len;
+	int rc;
+
+	if (ctx->buf && !ctx->fwd_held) {
+		rc = mctp_bridge_flow_send(ctx, true);
+		if (rc != -EBUSY)
+			return rc;
+		rc = mctp_bridge_flow_hold_pkt(mctp, ctx, NULL, 0);
+		if (rc)
+			return rc;
+	}
+
+	if (!ctx->fwd_held)
+		return 0;
+
+	len = ctx->buf_size - ctx->fwd_pos;
+	msg = __mctp_msg_alloc(MAX(len, (size_t)1), mctp);
+	if (!msg)
+		return -ENOMEM;
+	for (frag = ctx->frags, p = msg; frag; p += frag->len, frag = frag->next)
+		memcpy(p, frag->data, frag->len);
+
+	/* The rest keeps the packet size of what went before */
+	cont.seq = ctx->fwd_seq;
+	cont.pkt_len = ctx->buf ? MCTP_BODY_SIZE(ctx->fwd->binding->pkt_size) :
+				  ctx->fragment_size - sizeof(struct mctp_hdr);
+
+	iov.base = msg;
+	iov.len = len;
+	return mctp_message_tx_on_bus(ctx->fwd, ctx->src, ctx->dest,
+				      ctx->tag_owner, ctx->tag, &iov, 1, msg,
+				      NULL, ctx->fwd_pos ? &cont : NULL);
 }
 
-static int mctp_msg_ctx_add_pkt(struct mctp_msg_ctx *ctx,
+static int mctp_msg_ctx_add_pkt(struct mctp *mctp, struct mctp_msg_ctx *ctx,
 				struct mctp_pktbuf *pkt)
 {
 	size_t len;
+	int rc;
 
 	len = mctp_pktbuf_size(pkt) - sizeof(struct mctp_hdr);
+	ctx->last_used = ++mctp->msg_ctx_clock;
 
 	if (len + ctx->buf_size < ctx->buf_size) {
 		return -1;
 	}
 
+	if (ctx->stream) {
+		mctp_msg_ctx_stream(ctx, MCTP_STREAM_DATA,
+				    mctp_pktbuf_data(pkt), len);
+		ctx->buf_size += len;
+		return 0;
+	}
+
+	if (ctx->fwd) {
+		ctx->buf_size += len;
+		if (ctx->fwd_held)
+			return mctp_bridge_flow_hold(mctp, ctx,
+						     mctp_pktbuf_data(pkt), len);
+		if (ctx->buf)
+			return mctp_bridge_flow_add(mctp, ctx,
+						    mctp_pktbuf_data(pkt), len);
+
+		rc = mctp_bridge_tx_pkt(ctx->fwd, pkt);
+		if (rc != -EBUSY)
+			return rc;
+
+		/* Packets go out unchanged, so the rest continues from
+		 * this one's sequence number */
+		ctx->fwd_pos = ctx->buf_size - len;
+		ctx->fwd_seq = (mctp_pktbuf_hdr(pkt)->flags_seq_tag >>
+				MCTP_HDR_SEQ_SHIFT) &
+			       MCTP_HDR_SEQ_MASK;
+		return mctp_bridge_flow_hold(mctp, ctx, mctp_pktbuf_data(pkt),
+					     len);
+	}
+
+	if (ctx->chain) {
+		if (ctx->buf_size + len > mctp->max_message_size) {
+			mctp_prdebug("message exceeds max size %zu",
+				     mctp->max_message_size);
+			return -1;
+		}
+		if (mctp_msg_ctx_add_frag(mctp, ctx, mctp_pktbuf_data(pkt),
+					  len))
+			return -1;
+		ctx->buf_size += len;
+		return 0;
+	}
+
 	if (ctx->buf_size + len > ctx->buf_alloc_size) {
-		return -1;
+		if (mctp_msg_ctx_grow(mctp, ctx, ctx->buf_size + len))
+			return -1;
 	}
 
 	memcpy((uint8_t *)ctx->buf + ctx->buf_size, mctp_pktbuf_data(pkt), len);
@@ -270,12 +834,34 @@ static uint64_t mctp_default_now(void *ctx __unused)
 
 int mctp_setup(struct mctp *mctp, size_t struct_mctp_size)
 {
+	size_t i;
+
 	if (struct_mctp_size < sizeof(struct mctp)) {
 		mctp_prdebug("Mismatching struct mctp");
 		return -EINVAL;
 	}
 	memset(mctp, 0, sizeof(*mctp));
 	mctp->max_message_size = MCTP_MAX_MESSAGE_SIZE;
+	mctp->reassembly_initial_size = MCTP_REASSEMBLY_INITIAL_SIZE;
+	mctp->reassembly_timeout = MCTP_REASSEMBLY_TIMEOUT;
+	mctp->tx_queue_depth[MCTP_TX_CLASS_BULK] = MCTP_TX_QUEUE_DEPTH;
+	mctp->tx_queue_bytes[MCTP_TX_CLASS_BULK] = MCTP_TX_QUEUE_BYTES;
+	mctp->tx_queue_depth[MCTP_TX_CLASS_URGENT] = MCTP_TX_URGENT_DEPTH;
+	mctp->tx_queue_bytes[MCTP_TX_CLASS_URGENT] = MCTP_TX_URGENT_BYTES;
+	mctp->tx_urgent_run = MCTP_TX_URGENT_RUN;
+	mctp->tx_inflight = MCTP_TX_INFLIGHT;
+	mctp->tx_burst = MCTP_TX_BURST;
+	for (i = 0; i < ARRAY_SIZE(mctp->msg_ctxs); i++)
+		mctp->msg_ctx_free[i] = (uint16_t)(ARRAY_SIZE(mctp->msg_ctxs) -
+						   1 - i);
+	mctp->n_msg_ctx_free = ARRAY_SIZE(mctp->msg_ctxs);
+	for (i = 0; i < ARRAY_SIZE(mctp->req_tags); i++)
+		mctp->req_tag_free[i] = (uint16_t)(ARRAY_SIZE(mctp->req_tags) -
+						   1 - i);
+	mctp->n_req_tag_free = ARRAY_SIZE(mctp->req_tags);
+	mctp->req_pending_limit = MCTP_REQ_PENDING;
+	mctp_lock_init(&mctp->rx_lock);
+	mctp_lock_init(&mctp->tag_lock);
 #if MCTP_DEFAULT_CLOCK_GETTIME || defined(_WIN32)
 	mctp->platform_now = mctp_default_now;
 #endif
@@ -290,17 +876,133 @@ void mctp_set_max_message_size(struct mctp *mctp, size_t message_size)
 	mctp->max_message_size = message_size;
 }
 
+void mctp_set_reassembly_initial_size(struct mctp *mctp, size_t size)
+{
+	mctp->reassembly_initial_size = size;
+}
+
+void mctp_set_reassembly_timeout(struct mctp *mctp, uint64_t timeout_ms)
+{
+	mctp->reassembly_timeout = timeout_ms;
+}
+
+void mctp_set_reassembly_evict_lru(struct mctp *mctp, bool enable)
+{
+	mctp->reassembly_evict_lru = enable;
+}
+
+void mctp_set_tx_queue_limits(struct mctp *mctp, size_t depth, size_t bytes)
+{
+	mctp->tx_queue_depth[MCTP_TX_CLASS_BULK] = depth;
+	mctp->tx_queue_bytes[MCTP_TX_CLASS_BULK] = bytes;
+}
+
+void mctp_set_tx_urgent_limits(struct mctp *mctp, size_t depth, size_t bytes,
+			       size_t max_run)
+{
+	mctp->tx_queue_depth[MCTP_TX_CLASS_URGENT] = depth;
+	mctp->tx_queue_bytes[MCTP_TX_CLASS_URGENT] = bytes;
+	mctp->tx_urgent_run = MAX(max_run, (size_t)1);
+}
+
+void mctp_set_request_queue_limit(struct mctp *mctp, size_t depth)
+{
+	mctp->req_pending_limit = depth;
+}
+
+void mctp_get_request_stats(struct mctp *mctp, struct mctp_req_stats *stats)
+{
+	mctp_lock(&mctp->tag_lock);
+	*stats = mctp->req_stats;
+	mctp_unlock(&mctp->tag_lock);
+}
+
+void mctp_set_tag_filter(struct mctp *mctp, mctp_tag_filter_fn fn,
+			 void *data)
+{
+	mctp_lock(&mctp->tag_lock);
+	mctp->tag_filter = fn;
+	mctp->tag_filter_data = data;
+	mctp_unlock(&mctp->tag_lock);
+}
+
+void mctp_set_tx_interleave(struct mctp *mctp, size_t max_inflight,
+			    size_t burst)
+{
+	mctp->tx_inflight = MIN(MAX(max_inflight, (size_t)1),
+				(size_t)MCTP_TX_INFLIGHT_MAX);
+	mctp->tx_burst = MAX(burst, (size_t)1);
+}
+
 void mctp_set_capture_handler(struct mctp *mctp, mctp_capture_fn fn, void *user)
 {
 	mctp->capture = fn;
 	mctp->capture_data = user;
 }
 
+/* Release a finished message and report it to its completion callback */
+static void mctp_tx_msg_release(struct mctp *mctp, struct mctp_tx_msg *tx,
+				int status)
+{
+	mctp_tx_done_fn done = tx->done;
+	uint64_t elapsed = 0;
+	size_t sent = tx->pos;
+
+	if (done && mctp->platform_now)
+		elapsed = mctp_now(mctp) - tx->start;
+
+	if (tx->msg)
+		__mctp_msg_free(tx->msg, mctp);
+	if (done)
+		done(status, sent, elapsed, tx->done_data);
+	__mctp_free(tx);
+}
+
 static void mctp_bus_destroy(struct mctp_bus *bus, struct mctp *mctp)
 {
-	if (bus->tx_msg) {
-		__mctp_msg_free(bus->tx_msg, mctp);
-		bus->tx_msg = NULL;
+	struct mctp_tx_msg *tx;
+	uint16_t idx;
+	size_t i;
+
+	/* Completion callbacks can't queue more onto this bus */
+	bus->state = mctp_bus_state_constructed;
+
+	for (i = 0; i < ARRAY_SIZE(bus->tx_queues); i++) {
+		while (bus->tx_queues[i].head)
+			mctp_tx_msg_done(bus, bus->tx_queues[i].head,
+					 -ECANCELED);
+		memset(&bus->tx_queues[i], 0, sizeof(bus->tx_queues[i]));
+	}
+	bus->tx_urgent_run = 0;
+
+	mctp_lock(&mctp->tag_lock);
+	mctp_req_pending_cancel(mctp, bus);
+
+	/* Cancel the requests made on this bus. Callbacks may change the
+	 * list, so rescan it after each. */
+	for (idx = mctp->req_tag_head; idx;) {
+		if (&mctp->busses[mctp->req_tags[idx - 1].bus] == bus) {
+			mctp_req_tag_fail(mctp, idx - 1, -ECANCELED);
+			idx = mctp->req_tag_head;
+		} else {
+			idx = mctp->req_tags[idx - 1].next;
+		}
+	}
+	mctp_unlock(&mctp->tag_lock);
+
+	while ((tx = bus->tx_done)) {
+		bus->tx_done = tx->next;
+		mctp_tx_msg_release(mctp, tx, tx->status);
+	}
+	bus->tx_done_tail = NULL;
+
+	if (bus->tx_batch_pkts) {
+		__mctp_free(bus->tx_batch_pkts);
+		__mctp_free(bus->tx_batch_ents);
+		__mctp_free(bus->tx_batch_storage);
+		bus->tx_batch_pkts = NULL;
+		bus->tx_batch_ents = NULL;
+		bus->tx_batch_storage = NULL;
 	}
 }
 
@@ -312,12 +1014,24 @@ void mctp_cleanup(struct mctp *mctp)
 	static_assert(ARRAY_SIZE(mctp->msg_ctxs) < SIZE_MAX, "size");
 	for (i = 0; i < ARRAY_SIZE(mctp->msg_ctxs); i++) {
 		struct mctp_msg_ctx *tmp = &mctp->msg_ctxs[i];
+		if (tmp->stream)
+			mctp_msg_ctx_stream(tmp, MCTP_STREAM_ABORT, NULL,
+					    tmp->buf_size);
 		if (tmp->buf)
 			__mctp_msg_free(tmp->buf, mctp);
+		mctp_msg_ctx_free_frags(mctp, tmp);
 	}
 
-	while (mctp->n_busses--)
-		mctp_bus_destroy(&mctp->busses[mctp->n_busses], mctp);
+	while (mctp->n_busses--) {
+		if (mctp->busses[mctp->n_busses].binding) {
+			mctp_bus_destroy(&mctp->busses[mctp->n_busses], mctp);
+			mctp_lock_destroy(
+				&mctp->busses[mctp->n_busses].tx_lock);
+		}
+	}
+
+	mctp_lock_destroy(&mctp->tag_lock);
+	mctp_lock_destroy(&mctp->rx_lock);
 }
 
 void mctp_destroy(struct mctp *mctp)
@@ -333,43 +1047,162 @@ int mctp_set_rx_all(struct mctp *mctp, mctp_rx_fn fn, void *data)
 	return 0;
 }
 
-static struct mctp_bus *find_bus_for_eid(struct mctp *mctp, mctp_eid_t dest
-					 __attribute__((unused)))
+/* Find the most specific stream handler for a message. Wildcard types do
+ * not match control messages, which the control handler may need. */
+static struct mctp_stream_handler *
+mctp_stream_find(struct mctp *mctp, mctp_eid_t src, uint8_t msg_type)
 {
-	if (mctp->n_busses == 0)
-		return NULL;
+	struct mctp_stream_handler *h, *best = NULL;
+	int score, best_score = 0;
+	size_t i;
 
-	/* for now, just use the first bus. For full routing support,
-	 * we will need a table of neighbours */
-	return &mctp->busses[0];
-}
+	msg_type &= MCTP_MSG_TYPE_MASK;
 
-int mctp_register_bus(struct mctp *mctp, struct mctp_binding *binding,
-		      mctp_eid_t eid)
-{
-	int rc = 0;
+	for (i = 0; i < MCTP_STREAM_HANDLERS; i++) {
+		h = &mctp->stream_handlers[i];
+		if (!h->fn)
+			continue;
 
-	/* todo: multiple busses */
-	static_assert(MCTP_MAX_BUSSES >= 1, "need a bus");
-	assert(mctp->n_busses == 0);
-	mctp->n_busses = 1;
+		score = 1;
+		if (h->msg_type == msg_type)
+			score += 2;
+		else if (h->msg_type != MCTP_STREAM_ANY ||
+			 msg_type == MCTP_CTRL_HDR_MSG_TYPE)
+			continue;
 
-	assert(binding->tx_storage);
+		if (h->src == src)
+			score += 1;
+		else if (h->src != MCTP_STREAM_ANY)
+			continue;
 
-	memset(mctp->busses, 0, sizeof(struct mctp_bus));
-	mctp->busses[0].mctp = mctp;
-	mctp->busses[0].binding = binding;
-	mctp->busses[0].eid = eid;
-	binding->bus = &mctp->busses[0];
-	binding->mctp = mctp;
-	mctp->route_policy = ROUTE_ENDPOINT;
+		if (score > best_score) {
+			best = h;
+			best_score = score;
+		}
+	}
 
-	if (binding->start) {
-		rc = binding->start(binding);
+	return best;
+}
+
+int mctp_set_stream_handler(struct mctp *mctp, uint8_t msg_type,
+			    mctp_eid_t src, mctp_stream_fn fn, void *data)
+{
+	struct mctp_stream_handler *h, *spare = NULL;
+	size_t i;
+
+	if (msg_type != MCTP_STREAM_ANY)
+		msg_type &= MCTP_MSG_TYPE_MASK;
+
+	for (i = 0; i < MCTP_STREAM_HANDLERS; i++) {
+		h = &mctp->stream_handlers[i];
+		if (h->fn && h->msg_type == msg_type && h->src == src)
+			break;
+		if (!h->fn && !spare)
+			spare = h;
+	}
+
+	if (i == MCTP_STREAM_HANDLERS) {
+		if (!fn)
+			return -ENOENT;
+		if (!spare)
+			return -ENOSPC;
+		h = spare;
+	} else {
+		/* Messages in progress are aborted on the old handler */
+		for (i = 0; i < MCTP_REASSEMBLY_CTXS; i++) {
+			if (mctp->msg_ctxs[i].stream == h)
+				mctp_msg_ctx_drop(mctp, &mctp->msg_ctxs[i]);
+		}
+	}
+
+	h->msg_type = msg_type;
+	h->src = src;
+	h->fn = fn;
+	h->data = data;
+
+	return 0;
+}
+
+int mctp_set_rx_iov(struct mctp *mctp, mctp_rx_iov_fn fn, void *data)
+{
+	mctp->message_rx_iov = fn;
+	mctp->message_rx_iov_data = data;
+	return 0;
+}
+
+static struct mctp_bus *find_bus_for_eid(struct mctp *mctp, mctp_eid_t dest)
+{
+	uint8_t idx = mctp->routes[dest];
+
+	if (!idx)
+		idx = mctp->route_default;
+
+	return idx ? &mctp->busses[idx - 1] : NULL;
+}
+
+/* Free the slot of @bus, and drop the routes through it */
+static void mctp_bus_remove(struct mctp *mctp, struct mctp_bus *bus)
+{
+	uint8_t idx = (uint8_t)(bus - mctp->busses + 1);
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(mctp->routes); i++) {
+		if (mctp->routes[i] == idx)
+			mctp->routes[i] = 0;
+	}
+	if (mctp->route_default == idx)
+		mctp->route_default = 0;
+
+	mctp->local_eids[bus->eid]--;
+	mctp_lock_destroy(&bus->tx_lock);
+	bus->binding = NULL;
+
+	while (mctp->n_busses && !mctp->busses[mctp->n_busses - 1].binding)
+		mctp->n_busses--;
+}
+
+int mctp_register_bus(struct mctp *mctp, struct mctp_binding *binding,
+		      mctp_eid_t eid)
+{
+	struct mctp_bus *bus;
+	int i, rc = 0;
+
+	static_assert(MCTP_MAX_BUSSES >= 1, "need a bus");
+	assert(mctp->route_policy == ROUTE_ENDPOINT || mctp->n_busses == 0);
+
+	assert(binding->tx_storage);
+
+	/* Reuse the slot of an unregistered bus */
+	for (i = 0; i < mctp->n_busses; i++) {
+		if (!mctp->busses[i].binding)
+			break;
+	}
+	if (i == MCTP_MAX_BUSSES) {
+		mctp_prerr("Too many busses");
+		return -ENOSPC;
+	}
+
+	bus = &mctp->busses[i];
+	memset(bus, 0, sizeof(*bus));
+	mctp_lock_init(&bus->tx_lock);
+	bus->mctp = mctp;
+	bus->binding = binding;
+	bus->eid = eid;
+	binding->bus = bus;
+	binding->mctp = mctp;
+	mctp->route_policy = ROUTE_ENDPOINT;
+	if (i == mctp->n_busses)
+		mctp->n_busses++;
+	mctp->local_eids[eid]++;
+	if (!mctp->route_default)
+		mctp->route_default = (uint8_t)(i + 1);
+
+	if (binding->start) {
+		rc = binding->start(binding);
 		if (rc < 0) {
 			mctp_prerr("Failed to start binding: %d", rc);
+			mctp_bus_remove(mctp, bus);
 			binding->bus = NULL;
-			mctp->n_busses = 0;
 		}
 	}
 
@@ -378,25 +1211,58 @@ int mctp_register_bus(struct mctp *mctp, struct mctp_binding *binding,
 
 int mctp_bus_set_eid(struct mctp_binding *binding, mctp_eid_t eid)
 {
+	struct mctp_bus *bus = binding->bus;
+
 	if (eid < 8 || eid == 0xff) {
 		return -EINVAL;
 	}
 
-	binding->bus->eid = eid;
+	if (bus->mctp->route_policy == ROUTE_ENDPOINT) {
+		bus->mctp->local_eids[bus->eid]--;
+		bus->mctp->local_eids[eid]++;
+	}
+	bus->eid = eid;
 	return 0;
 }
 
 void mctp_unregister_bus(struct mctp *mctp, struct mctp_binding *binding)
 {
-	/*
-	 * We only support one bus right now; once the call completes we will
-	 * have no more busses
-	 */
-	mctp->n_busses = 0;
+	if (binding->bus) {
+		mctp_bus_destroy(binding->bus, mctp);
+		mctp_bus_remove(mctp, binding->bus);
+	}
 	binding->mctp = NULL;
 	binding->bus = NULL;
 }
 
+int mctp_set_route(struct mctp *mctp, mctp_eid_t first, mctp_eid_t last,
+		   struct mctp_binding *binding)
+{
+	uint8_t idx = 0;
+
+	if (first > last)
+		return -EINVAL;
+
+	if (binding) {
+		if (binding->mctp != mctp || !binding->bus)
+			return -EINVAL;
+		idx = (uint8_t)(binding->bus - mctp->busses + 1);
+	}
+
+	memset(&mctp->routes[first], idx, last - first + 1);
+	return 0;
+}
+
+int mctp_set_default_route(struct mctp *mctp, struct mctp_binding *binding)
+{
+	if (binding && (binding->mctp != mctp || !binding->bus))
+		return -EINVAL;
+
+	mctp->route_default =
+		binding ? (uint8_t)(binding->bus - mctp->busses + 1) : 0;
+	return 0;
+}
+
 int mctp_bridge_busses(struct mctp *mctp, struct mctp_binding *b1,
 		       struct mctp_binding *b2)
 {
@@ -409,14 +1275,19 @@ int mctp_bridge_busses(struct mctp *mctp, struct mctp_binding *b1,
 	assert(MCTP_MAX_BUSSES >= 2);
 	memset(mctp->busses, 0, 2 * sizeof(struct mctp_bus));
 	mctp->n_busses = 2;
+	mctp_lock_init(&mctp->busses[0].tx_lock);
+	mctp_lock_init(&mctp->busses[1].tx_lock);
+	mctp->busses[0].mctp = mctp;
 	mctp->busses[0].binding = b1;
 	b1->bus = &mctp->busses[0];
 	b1->mctp = mctp;
+	mctp->busses[1].mctp = mctp;
 	mctp->busses[1].binding = b2;
 	b2->bus = &mctp->busses[1];
 	b2->mctp = mctp;
 
 	mctp->route_policy = ROUTE_BRIDGE;
+	mctp->route_default = 1;
 
 	if (b1->start) {
 		rc = b1->start(b1);
@@ -492,7 +1363,7 @@ static bool mctp_ctrl_handle_msg(struct mctp_bus *bus, mctp_eid_t src,
 static inline bool mctp_rx_dest_is_local(struct mctp_bus *bus, mctp_eid_t dest)
 {
 	return dest == bus->eid || dest == MCTP_EID_NULL ||
-	       dest == MCTP_EID_BROADCAST;
+	       dest == MCTP_EID_BROADCAST || bus->mctp->local_eids[dest];
 }
 
 static inline bool mctp_ctrl_cmd_is_request(struct mctp_ctrl_msg_hdr *hdr)
@@ -501,63 +1372,257 @@ static inline bool mctp_ctrl_cmd_is_request(struct mctp_ctrl_msg_hdr *hdr)
 	       hdr->rq_dgram_inst & MCTP_CTRL_HDR_FLAG_REQUEST;
 }
 
+/* Copy a message held as a list of regions into one new allocation */
+static void *mctp_msg_linearize(const struct mctp_iovec *iov, size_t iovcnt,
+				size_t len, struct mctp *mctp)
+{
+	uint8_t *copy, *p;
+	size_t i;
+
+	copy = __mctp_msg_alloc(len, mctp);
+	if (!copy) {
+		mctp_prdebug("msg linearize len %zu failed", len);
+		return NULL;
+	}
+
+	for (i = 0, p = copy; i < iovcnt; p += iov[i].len, i++)
+		memcpy(p, iov[i].base, iov[i].len);
+
+	return copy;
+}
+
 /*
  * Receive the complete MCTP message and route it.
+ * The message is described by 'iov', one region per fragment for a
+ * fragment chain, or a single region otherwise. It is only valid for the
+ * duration of the call. If a single region is a separate allocation,
+ * 'owner' points at the reference to it, so that mctp_rx_msg_take() can
+ * hand it over rather than copy.
  * Asserts:
- *     'buf' is not NULL.
+ *     'iov' is not NULL.
  */
 static void mctp_rx(struct mctp *mctp, struct mctp_bus *bus, mctp_eid_t src,
-		    mctp_eid_t dest, bool tag_owner, uint8_t msg_tag, void *buf,
-		    size_t len)
+		    mctp_eid_t dest, bool tag_owner, uint8_t msg_tag,
+		    const struct mctp_iovec *iov, size_t iovcnt, size_t len,
+		    void **owner)
 {
-	assert(buf != NULL);
+	struct mctp_rx_msg prev_rx_msg;
+	mctp_resp_fn resp;
+	void *resp_data;
+	void *flat = NULL;
+	void *buf;
+
+	assert(iov != NULL && iovcnt > 0);
+
+	/* Flat view of the message, if it is in one piece */
+	buf = iovcnt == 1 ? (void *)iov[0].base : NULL;
 
 	if (mctp->route_policy == ROUTE_ENDPOINT &&
 	    mctp_rx_dest_is_local(bus, dest)) {
-		/* Note responses to allocated tags */
+		/* Note responses to allocated tags, and pass those to the
+		 * request's response callback if it has one */
 		if (!tag_owner) {
-			mctp_dealloc_tag(bus, dest, src, msg_tag);
+			resp = mctp_dealloc_tag(bus, dest, src, msg_tag,
+						&resp_data);
+			if (resp) {
+				if (!buf)
+					flat = mctp_msg_linearize(iov, iovcnt,
+								  len, mctp);
+				if (!buf && !flat) {
+					resp(src, msg_tag, -ENOMEM, NULL, 0,
+					     resp_data);
+					return;
+				}
+
+				prev_rx_msg = mctp->rx_msg;
+				mctp->rx_msg.iov = iov;
+				mctp->rx_msg.iovcnt = iovcnt;
+				mctp->rx_msg.len = len;
+				mctp->rx_msg.owner = owner;
+				mctp->rx_msg.valid = true;
+				resp(src, msg_tag, 0, buf ? buf : flat, len,
+				     resp_data);
+				mctp->rx_msg = prev_rx_msg;
+				goto out;
+			}
 		}
 
 		/* Handle MCTP Control Messages: */
 		if (len >= sizeof(struct mctp_ctrl_msg_hdr)) {
-			struct mctp_ctrl_msg_hdr *msg_hdr = buf;
+			struct mctp_ctrl_msg_hdr msg_hdr;
+
+			if (iov[0].len >= sizeof(msg_hdr)) {
+				memcpy(&msg_hdr, iov[0].base, sizeof(msg_hdr));
+			} else {
+				flat = mctp_msg_linearize(iov, iovcnt, len,
+							  mctp);
+				if (!flat)
+					return;
+				memcpy(&msg_hdr, flat, sizeof(msg_hdr));
+			}
 
 			/*
 			 * Identify if this is a control request message.
 			 * See DSP0236 v1.3.0 sec. 11.5.
 			 */
-			if (mctp_ctrl_cmd_is_request(msg_hdr)) {
+			if (mctp_ctrl_cmd_is_request(&msg_hdr)) {
 				bool handled;
+
+				/* Control handlers need a flat message */
+				if (!buf && !flat)
+					flat = mctp_msg_linearize(iov, iovcnt,
+								  len, mctp);
+				if (!buf && !flat)
+					return;
 				handled = mctp_ctrl_handle_msg(
-					bus, src, msg_tag, tag_owner, buf, len);
+					bus, src, msg_tag, tag_owner,
+					buf ? buf : flat, len);
 				if (handled)
-					return;
+					goto out;
 			}
 		}
 
-		if (mctp->message_rx)
-			mctp->message_rx(src, tag_owner, msg_tag,
-					 mctp->message_rx_data, buf, len);
+		if (mctp->message_rx_iov || mctp->message_rx) {
+			/* The callback may transmit, and a loopback binding
+			 * can re-enter mctp_rx() */
+			prev_rx_msg = mctp->rx_msg;
+			mctp->rx_msg.iov = iov;
+			mctp->rx_msg.iovcnt = iovcnt;
+			mctp->rx_msg.len = len;
+			mctp->rx_msg.owner = owner;
+			mctp->rx_msg.valid = true;
+
+			if (mctp->message_rx_iov) {
+				mctp->message_rx_iov(src, tag_owner, msg_tag,
+						     mctp->message_rx_iov_data,
+						     iov, iovcnt, len);
+			} else {
+				if (!buf && !flat)
+					flat = mctp_msg_linearize(iov, iovcnt,
+								  len, mctp);
+				if (buf || flat)
+					mctp->message_rx(
+						src, tag_owner, msg_tag,
+						mctp->message_rx_data,
+						buf ? buf : flat, len);
+			}
+
+			mctp->rx_msg = prev_rx_msg;
+		}
 	}
 
 	if (mctp->route_policy == ROUTE_BRIDGE) {
+		uint8_t route = mctp->routes[dest];
 		int i;
 
+		/* Forward to the routed bus, or to all others */
 		for (i = 0; i < mctp->n_busses; i++) {
 			struct mctp_bus *dest_bus = &mctp->busses[i];
-			if (dest_bus == bus)
+			if (dest_bus == bus || (route && route != i + 1))
 				continue;
 
-			void *copy = mctp_msg_dup(buf, len, mctp);
+			void *copy = mctp_msg_linearize(iov, iovcnt, len,
+							mctp);
 			if (!copy) {
-				return;
+				goto out;
 			}
 
+			struct mctp_iovec fwd = { copy, len };
 			mctp_message_tx_on_bus(dest_bus, src, dest, tag_owner,
-					       msg_tag, copy, len);
+					       msg_tag, &fwd, 1, copy, NULL, NULL);
 		}
 	}
+
+out:
+	if (flat)
+		__mctp_msg_free(flat, mctp);
+}
+
+/* Stream handler for a message starting with the payload in @iov, if any.
+ * Streaming is only for local delivery, and responses to requests with a
+ * response callback go to that instead. */
+static struct mctp_stream_handler *
+mctp_rx_stream_find(struct mctp *mctp, const struct mctp_hdr *hdr,
+		    const struct mctp_iovec *iov)
+{
+	struct mctp_req_tag *r;
+	bool has_fn;
+	uint8_t tag;
+
+	if (mctp->route_policy != ROUTE_ENDPOINT || !iov->len)
+		return NULL;
+
+	if (!(hdr->flags_seq_tag & MCTP_HDR_FLAG_TO)) {
+		tag = (hdr->flags_seq_tag >> MCTP_HDR_TAG_SHIFT) &
+		      MCTP_HDR_TAG_MASK;
+		mctp_lock(&mctp->tag_lock);
+		r = mctp_req_tag_lookup(mctp, hdr->dest, hdr->src, tag);
+		has_fn = r && r->fn;
+		mctp_unlock(&mctp->tag_lock);
+		if (has_fn)
+			return NULL;
+	}
+
+	return mctp_stream_find(mctp, hdr->src, *(const uint8_t *)iov->base);
+}
+
+/* Stream a single-packet message, as START, DATA and END */
+static void mctp_rx_stream_single(struct mctp_bus *bus,
+				  struct mctp_stream_handler *h,
+				  struct mctp_hdr *hdr, bool tag_owner,
+				  uint8_t tag, const struct mctp_iovec *iov)
+{
+	h->fn(hdr->src, tag_owner, tag, h->data, MCTP_STREAM_START, NULL, 0);
+	h->fn(hdr->src, tag_owner, tag, h->data, MCTP_STREAM_DATA, iov->base,
+	      iov->len);
+	if (!tag_owner)
+		mctp_dealloc_tag(bus, hdr->dest, hdr->src, tag, NULL);
+	h->fn(hdr->src, tag_owner, tag, h->data, MCTP_STREAM_END, NULL,
+	      iov->len);
+}
+
+/* Complete a streamed message */
+static void mctp_msg_ctx_stream_end(struct mctp_bus *bus,
+				    struct mctp_msg_ctx *ctx)
+{
+	/* Note responses to allocated tags */
+	if (!ctx->tag_owner)
+		mctp_dealloc_tag(bus, ctx->dest, ctx->src, ctx->tag, NULL);
+
+	mctp_msg_ctx_stream(ctx, MCTP_STREAM_END, NULL, ctx->buf_size);
+	ctx->stream = NULL;
+}
+
+/* Pass a completely reassembled message up to mctp_rx() */
+static void mctp_msg_ctx_deliver(struct mctp *mctp, struct mctp_bus *bus,
+				 struct mctp_msg_ctx *ctx, bool tag_owner)
+{
+	struct mctp_msg_frag *frag;
+	struct mctp_iovec *iov;
+	size_t i;
+
+	if (!ctx->chain) {
+		struct mctp_iovec flat = { ctx->buf, ctx->buf_size };
+
+		mctp_rx(mctp, bus, ctx->src, ctx->dest, tag_owner, ctx->tag,
+			&flat, 1, ctx->buf_size, &ctx->buf);
+		return;
+	}
+
+	iov = __mctp_alloc(ctx->n_frags * sizeof(*iov));
+	if (!iov) {
+		mctp_prdebug("no memory for %zu fragment iov", ctx->n_frags);
+		return;
+	}
+
+	for (i = 0, frag = ctx->frags; frag; frag = frag->next, i++) {
+		iov[i].base = frag->data;
+		iov[i].len = frag->len;
+	}
+
+	mctp_rx(mctp, bus, ctx->src, ctx->dest, tag_owner, ctx->tag, iov,
+		ctx->n_frags, ctx->buf_size, NULL);
+	__mctp_free(iov);
 }
 
 void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
@@ -567,13 +1632,17 @@ void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
 	uint8_t flags, exp_seq, seq, tag;
 	struct mctp_msg_ctx *ctx;
 	struct mctp_hdr *hdr;
-	bool tag_owner;
+	struct mctp_stream_handler *stream;
+	struct mctp_bus *fwd;
+	struct mctp_iovec iov;
+	bool tag_owner, tag_freed;
 	size_t len;
-	void *p;
 	int rc;
 
 	assert(bus);
 
+	mctp_lock(&mctp->rx_lock);
+
 	/* Drop packet if it was smaller than mctp hdr size */
 	if (mctp_pktbuf_size(pkt) < sizeof(struct mctp_hdr))
 		goto out;
@@ -604,43 +1673,64 @@ void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
 	switch (flags) {
 	case MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM:
 		/* single-packet message - send straight up to rx function,
-		 * no need to create a message context */
-		len = pkt->end - pkt->mctp_hdr_off - sizeof(struct mctp_hdr);
-		p = mctp_msg_dup(pkt->data + pkt->mctp_hdr_off +
-					 sizeof(struct mctp_hdr),
-				 len, mctp);
-		if (p) {
+		 * no need to create a message context. The payload is passed
+		 * in place, as a view into the packet buffer. */
+		fwd = mctp_bridge_cut_through(bus, hdr->dest);
+		if (fwd && mctp_pktbuf_size(pkt) <= fwd->binding->pkt_size &&
+		    !mctp_bridge_tx_pkt(fwd, pkt))
+			break;
+
+		iov.base = mctp_pktbuf_data(pkt);
+		iov.len = pkt->end - pkt->mctp_hdr_off -
+			  sizeof(struct mctp_hdr);
+		stream = mctp_rx_stream_find(mctp, hdr, &iov);
+		if (stream)
+			mctp_rx_stream_single(bus, stream, hdr, tag_owner, tag,
+					      &iov);
+		else
 			mctp_rx(mctp, bus, hdr->src, hdr->dest, tag_owner, tag,
-				p, len);
-			__mctp_msg_free(p, mctp);
-		}
+				&iov, 1, iov.len, NULL);
 		break;
 
 	case MCTP_HDR_FLAG_SOM:
 		/* start of a new message - start the new context for
 		 * future message reception. If an existing context is
 		 * already present, drop it. */
+		iov.base = mctp_pktbuf_data(pkt);
+		iov.len = mctp_pktbuf_size(pkt) - sizeof(struct mctp_hdr);
+		stream = mctp_rx_stream_find(mctp, hdr, &iov);
+		fwd = mctp_bridge_cut_through(bus, hdr->dest);
 		ctx = mctp_msg_ctx_lookup(mctp, hdr->src, hdr->dest, tag);
+		if (ctx && (ctx->stream || stream || ctx->fwd || fwd)) {
+			/* Streams are not restarted in place */
+			mctp_msg_ctx_drop(mctp, ctx);
+			ctx = NULL;
+		}
 		if (ctx) {
-			mctp_msg_ctx_reset(ctx);
+			mctp_msg_ctx_reset(mctp, ctx);
 		} else {
 			ctx = mctp_msg_ctx_create(mctp, hdr->src, hdr->dest,
-						  tag);
+						  tag, tag_owner, iov.len,
+						  stream, fwd);
 			/* If context creation fails due to exhaution of contexts we
 			* can support, drop the packet */
 			if (!ctx) {
 				mctp_prdebug("Context buffers exhausted.");
 				goto out;
 			}
+			if (fwd && mctp_bridge_flow_start(mctp, bus, ctx)) {
+				mctp_msg_ctx_drop(mctp, ctx);
+				goto out;
+			}
 		}
 
 		/* Save the fragment size, subsequent middle fragments
 		 * should of the same size */
 		ctx->fragment_size = mctp_pktbuf_size(pkt);
 
-		rc = mctp_msg_ctx_add_pkt(ctx, pkt);
+		rc = mctp_msg_ctx_add_pkt(mctp, ctx, pkt);
 		if (rc) {
-			mctp_msg_ctx_drop(bus, ctx);
+			mctp_msg_ctx_drop(mctp, ctx);
 		} else {
 			ctx->last_seq = seq;
 		}
@@ -658,7 +1748,7 @@ void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
 			mctp_prdebug(
 				"Sequence number %d does not match expected %d",
 				seq, exp_seq);
-			mctp_msg_ctx_drop(bus, ctx);
+			mctp_msg_ctx_drop(mctp, ctx);
 			goto out;
 		}
 
@@ -668,16 +1758,22 @@ void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
 			mctp_prdebug("Unexpected fragment size. Expected"
 				     " less than %zu, received = %zu",
 				     ctx->fragment_size, len);
-			mctp_msg_ctx_drop(bus, ctx);
+			mctp_msg_ctx_drop(mctp, ctx);
 			goto out;
 		}
 
-		rc = mctp_msg_ctx_add_pkt(ctx, pkt);
-		if (!rc)
-			mctp_rx(mctp, bus, ctx->src, ctx->dest, tag_owner, tag,
-				ctx->buf, ctx->buf_size);
-
-		mctp_msg_ctx_drop(bus, ctx);
+		rc = mctp_msg_ctx_add_pkt(mctp, ctx, pkt);
+		if (!rc && ctx->stream)
+			mctp_msg_ctx_stream_end(bus, ctx);
+		else if (!rc && ctx->fwd) {
+			rc = mctp_bridge_flow_end(mctp, ctx);
+			if (rc)
+				mctp_prdebug("bridged message dropped: %d",
+					     rc);
+		} else if (!rc)
+			mctp_msg_ctx_deliver(mctp, bus, ctx, tag_owner);
+
+		mctp_msg_ctx_drop(mctp, ctx);
 		break;
 
 	case 0:
@@ -691,7 +1787,7 @@ void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
 			mctp_prdebug(
 				"Sequence number %d does not match expected %d",
 				seq, exp_seq);
-			mctp_msg_ctx_drop(bus, ctx);
+			mctp_msg_ctx_drop(mctp, ctx);
 			goto out;
 		}
 
@@ -699,13 +1795,13 @@ void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
 
 		if (len != ctx->fragment_size) {
 			printf("CORE: Fragment size mismatch! len=%zu exp=%zu\n", len, ctx->fragment_size);
-			mctp_msg_ctx_drop(bus, ctx);
+			mctp_msg_ctx_drop(mctp, ctx);
 			goto out;
 		}
 
-		rc = mctp_msg_ctx_add_pkt(ctx, pkt);
+		rc = mctp_msg_ctx_add_pkt(mctp, ctx, pkt);
 		if (rc) {
-			mctp_msg_ctx_drop(bus, ctx);
+			mctp_msg_ctx_drop(mctp, ctx);
 			goto out;
 		}
 		ctx->last_seq = seq;
@@ -713,18 +1809,20 @@ void mctp_bus_rx(struct mctp_binding *binding, struct mctp_pktbuf *pkt)
 		break;
 	}
 out:
-	return;
+	tag_freed = mctp->rx_tag_freed;
+	mctp->rx_tag_freed = false;
+	mctp_unlock(&mctp->rx_lock);
+
+	/* Send held requests on the tags that responses freed */
+	if (tag_freed)
+		mctp_req_pending_run(mctp);
 }
 
+/* Callers check the bus is enabled for TX, under its lock */
 static int mctp_packet_tx(struct mctp_bus *bus, struct mctp_pktbuf *pkt)
 {
 	struct mctp *mctp = bus->binding->mctp;
 
-	if (bus->state != mctp_bus_state_tx_enabled) {
-		mctp_prdebug("tx with bus disabled");
-		return -1;
-	}
-
 	if (mctp->capture)
 		mctp->capture(pkt, MCTP_MESSAGE_CAPTURE_OUTGOING,
 			      mctp->capture_data);
@@ -732,101 +1830,602 @@ static int mctp_packet_tx(struct mctp_bus *bus, struct mctp_pktbuf *pkt)
 	return bus->binding->tx(bus->binding, pkt);
 }
 
-/* Returns a pointer to the binding's tx_storage */
-static struct mctp_pktbuf *mctp_next_tx_pkt(struct mctp_bus *bus)
+/* Payload length of the packet at @pos in @tx */
+static size_t mctp_tx_pktlen(struct mctp_bus *bus,
+			     const struct mctp_tx_msg *tx, size_t pos)
 {
-	if (!bus->tx_msg) {
-		return NULL;
-	}
+	size_t body = tx->cont_len ? tx->cont_len :
+				     MCTP_BODY_SIZE(bus->binding->pkt_size);
 
-	size_t p = bus->tx_msgpos;
-	size_t msg_len = bus->tx_msglen;
-	size_t payload_len = msg_len - p;
-	size_t max_payload_len = MCTP_BODY_SIZE(bus->binding->pkt_size);
-	if (payload_len > max_payload_len)
-		payload_len = max_payload_len;
+	return MIN(tx->len - pos, body);
+}
 
-	struct mctp_pktbuf *pkt =
-		mctp_pktbuf_init(bus->binding, bus->binding->tx_storage);
-	struct mctp_hdr *hdr = mctp_pktbuf_hdr(pkt);
+/* Fill in the header of the packet at @pos in @tx, sent with sequence
+ * number @seq. Returns the packet payload length. */
+static size_t mctp_tx_hdr(struct mctp_bus *bus, const struct mctp_tx_msg *tx,
+			  size_t pos, uint8_t seq, struct mctp_hdr *hdr)
+{
+	size_t payload_len = mctp_tx_pktlen(bus, tx, pos);
+	uint8_t flags_seq_tag;
 
 	hdr->ver = bus->binding->version & 0xf;
-	hdr->dest = bus->tx_dest;
-	hdr->src = bus->tx_src;
-	uint8_t flags_seq_tag = (bus->tx_to << MCTP_HDR_TO_SHIFT) |
-			     (bus->tx_tag << MCTP_HDR_TAG_SHIFT);
-	if (p == 0)
+	hdr->dest = tx->dest;
+	hdr->src = tx->src;
+	flags_seq_tag = (tx->tag_owner << MCTP_HDR_TO_SHIFT) |
+			(tx->tag << MCTP_HDR_TAG_SHIFT);
+	if (pos == 0 && !tx->cont_len)
 		flags_seq_tag |= MCTP_HDR_FLAG_SOM;
-	if (p + payload_len >= msg_len)
+	if (pos + payload_len >= tx->len)
 		flags_seq_tag |= MCTP_HDR_FLAG_EOM;
-	flags_seq_tag |= (bus->tx_seq << MCTP_HDR_SEQ_SHIFT);
+	flags_seq_tag |= (seq << MCTP_HDR_SEQ_SHIFT);
 
 	hdr->flags_seq_tag = flags_seq_tag;
 
-	memcpy(mctp_pktbuf_data(pkt), (uint8_t *)bus->tx_msg + p, payload_len);
-	pkt->end = pkt->start + sizeof(*hdr) + payload_len;
-	bus->tx_pktlen = payload_len;
-
 	mctp_prdebug(
 		"tx dst %d tag %d payload len %zu seq %d. msg pos %zu len %zu",
-		hdr->dest, bus->tx_tag, payload_len, bus->tx_seq, p, msg_len);
+		hdr->dest, tx->tag, payload_len, seq, pos, tx->len);
+
+	return payload_len;
+}
+
+/* Find the region of @tx holding message offset @pos, and the offset
+ * within it */
+static const struct mctp_iovec *mctp_tx_region(const struct mctp_tx_msg *tx,
+					       size_t *pos)
+{
+	const struct mctp_iovec *iov = tx->iov;
+	const struct mctp_iovec *end = tx->iov + tx->iovcnt;
+
+	while (iov + 1 < end && *pos >= iov->len) {
+		*pos -= iov->len;
+		iov++;
+	}
+
+	return iov;
+}
+
+/* The @len bytes at @pos in @tx, if they are held in a single region */
+static const void *mctp_tx_contig(const struct mctp_tx_msg *tx, size_t pos,
+				  size_t len)
+{
+	const struct mctp_iovec *iov;
+
+	if (!tx->iovcnt)
+		return NULL;
+
+	iov = mctp_tx_region(tx, &pos);
+	if (len > iov->len - pos)
+		return NULL;
+
+	return (const uint8_t *)iov->base + pos;
+}
+
+/* Copy the @len bytes at @pos in @tx to @dst, across regions */
+static void mctp_tx_copy(const struct mctp_tx_msg *tx, size_t pos,
+			 void *dst, size_t len)
+{
+	const struct mctp_iovec *iov;
+	uint8_t *p = dst;
+	size_t n;
+
+	if (!len)
+		return;
+
+	iov = mctp_tx_region(tx, &pos);
+	while (len) {
+		n = MIN(len, iov->len - pos);
+		/* Empty regions may have no base */
+		if (n)
+			memcpy(p, (const uint8_t *)iov->base + pos, n);
+		p += n;
+		len -= n;
+		pos = 0;
+		iov++;
+	}
+}
+
+/* Build the packet at @pos in @tx in @storage */
+static struct mctp_pktbuf *mctp_tx_pkt(struct mctp_bus *bus,
+				       const struct mctp_tx_msg *tx,
+				       size_t pos, uint8_t seq, void *storage)
+{
+	struct mctp_pktbuf *pkt;
+	size_t payload_len;
+
+	pkt = mctp_pktbuf_init(bus->binding, storage);
+	payload_len = mctp_tx_hdr(bus, tx, pos, seq, mctp_pktbuf_hdr(pkt));
+
+	mctp_tx_copy(tx, pos, mctp_pktbuf_data(pkt), payload_len);
+	pkt->end = pkt->start + sizeof(struct mctp_hdr) + payload_len;
 
 	return pkt;
 }
 
-/* Called when a packet has successfully been sent */
-static void mctp_tx_complete(struct mctp_bus *bus)
+/* Messages with the same source, destination and tag must not interleave,
+ * the receiver would take them as one */
+static inline bool mctp_tx_msg_same_flow(const struct mctp_tx_msg *a,
+					 const struct mctp_tx_msg *b)
+{
+	return a->src == b->src && a->dest == b->dest && a->tag == b->tag;
+}
+
+/* A message may not start while a message of the other class with the
+ * same flow is queued ahead of it: urgent messages wait for a bulk message
+ * that has already started, and bulk messages that have not started yet
+ * wait for urgent ones. */
+static bool mctp_tx_flow_blocked(struct mctp_bus *bus,
+				 const struct mctp_tx_msg *tx)
 {
-	if (!bus->tx_msg) {
-		mctp_prdebug("tx complete no message");
+	const struct mctp_tx_queue *other;
+	const struct mctp_tx_msg *o;
+	size_t seen;
+
+	if (tx->tx_class == MCTP_TX_CLASS_URGENT) {
+		other = &bus->tx_queues[MCTP_TX_CLASS_BULK];
+		for (o = other->head, seen = 0;
+		     o && seen < bus->mctp->tx_inflight; o = o->next, seen++) {
+			if (o->next_pos && mctp_tx_msg_same_flow(o, tx))
+				return true;
+		}
+		return false;
+	}
+
+	if (tx->next_pos)
+		return false;
+
+	other = &bus->tx_queues[MCTP_TX_CLASS_URGENT];
+	for (o = other->head; o; o = o->next) {
+		if (mctp_tx_msg_same_flow(o, tx))
+			return true;
+	}
+	return false;
+}
+
+/* Collect the messages of @q that may send their next packet: those among
+ * the first tx_inflight of the queue that have packets left and don't
+ * share a flow with an earlier message. Returns the count, in queue
+ * order. */
+static size_t mctp_tx_window(struct mctp_bus *bus, struct mctp_tx_queue *q,
+			     struct mctp_tx_msg **win)
+{
+	struct mctp_tx_msg *tx, *prev;
+	size_t seen, n = 0;
+
+	for (tx = q->head, seen = 0; tx && seen < bus->mctp->tx_inflight;
+	     tx = tx->next, seen++) {
+		for (prev = q->head; prev != tx; prev = prev->next) {
+			if (mctp_tx_msg_same_flow(prev, tx))
+				break;
+		}
+		if (prev == tx && !tx->next_done &&
+		    !mctp_tx_flow_blocked(bus, tx))
+			win[n++] = tx;
+	}
+
+	return n;
+}
+
+/* Choose the message of @q for the next packet from its @n window
+ * entries. The current message keeps the bus for tx_burst packets, then
+ * the turn passes round-robin to the next message of the window in queue
+ * order. */
+static struct mctp_tx_msg *mctp_tx_pick_queue(struct mctp_bus *bus,
+					      struct mctp_tx_queue *q,
+					      struct mctp_tx_msg **win,
+					      size_t n)
+{
+	struct mctp_tx_msg *start, *tx;
+	size_t i, k;
+
+	for (i = 0; i < n && q->burst; i++) {
+		if (win[i] == q->cur)
+			return win[i];
+	}
+
+	/* First window entry at or after the current message's successor */
+	start = q->cur ? q->cur->next : q->next;
+	for (tx = start, k = 0, i = n; tx && i == n && k <= n;
+	     tx = tx->next, k++) {
+		for (i = 0; i < n && win[i] != tx; i++)
+			;
+	}
+	if (i == n)
+		i = 0;
+
+	q->cur = win[i];
+	q->burst = bus->mctp->tx_burst;
+	return win[i];
+}
+
+/* Choose the message for the next packet. Urgent messages go first, but
+ * while a bulk message is waiting it gets one packet after every
+ * tx_urgent_run urgent ones. */
+static struct mctp_tx_msg *mctp_tx_pick(struct mctp_bus *bus)
+{
+	struct mctp_tx_queue *urgent = &bus->tx_queues[MCTP_TX_CLASS_URGENT];
+	struct mctp_tx_queue *bulk = &bus->tx_queues[MCTP_TX_CLASS_BULK];
+	struct mctp_tx_msg *uwin[MCTP_TX_INFLIGHT_MAX];
+	struct mctp_tx_msg *bwin[MCTP_TX_INFLIGHT_MAX];
+	size_t nu, nb;
+
+	nu = mctp_tx_window(bus, urgent, uwin);
+	nb = mctp_tx_window(bus, bulk, bwin);
+
+	if (nu && (!nb || bus->tx_urgent_run < bus->mctp->tx_urgent_run)) {
+		if (nb)
+			bus->tx_urgent_run++;
+		return mctp_tx_pick_queue(bus, urgent, uwin, nu);
+	}
+
+	if (!nb)
+		return NULL;
+
+	bus->tx_urgent_run = 0;
+	return mctp_tx_pick_queue(bus, bulk, bwin, nb);
+}
+
+/* Move the pending position of @tx past its next packet */
+static void mctp_tx_advance(struct mctp_bus *bus, struct mctp_tx_msg *tx)
+{
+	struct mctp_tx_queue *q = &bus->tx_queues[tx->tx_class];
+
+	tx->next_pos += mctp_tx_pktlen(bus, tx, tx->next_pos);
+	tx->next_seq = (tx->next_seq + 1) & MCTP_HDR_SEQ_MASK;
+	if (tx->next_pos >= tx->len)
+		tx->next_done = true;
+	if (q->burst)
+		q->burst--;
+}
+
+static void mctp_tx_sched_save(struct mctp_bus *bus,
+			       struct mctp_tx_sched *sched)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(bus->tx_queues); i++) {
+		sched->q[i].cur = bus->tx_queues[i].cur;
+		sched->q[i].next = bus->tx_queues[i].next;
+		sched->q[i].burst = bus->tx_queues[i].burst;
+	}
+	sched->urgent_run = bus->tx_urgent_run;
+}
+
+static void mctp_tx_sched_restore(struct mctp_bus *bus,
+				  const struct mctp_tx_sched *sched)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(bus->tx_queues); i++) {
+		bus->tx_queues[i].cur = sched->q[i].cur;
+		bus->tx_queues[i].next = sched->q[i].next;
+		bus->tx_queues[i].burst = sched->q[i].burst;
+	}
+	bus->tx_urgent_run = sched->urgent_run;
+}
+
+/* Remove @tx from the TX queue onto the done list, finished with
+ * @status */
+static void mctp_tx_msg_done(struct mctp_bus *bus, struct mctp_tx_msg *tx,
+			     int status)
+{
+	struct mctp_tx_queue *q = &bus->tx_queues[tx->tx_class];
+	struct mctp_tx_msg **pp, *prev = NULL;
+
+	for (pp = &q->head; *pp != tx; pp = &(*pp)->next)
+		prev = *pp;
+	*pp = tx->next;
+	if (q->tail == tx)
+		q->tail = prev;
+
+	/* Resume the round-robin after the removed message */
+	if (q->cur == tx) {
+		q->cur = NULL;
+		q->burst = 0;
+		q->next = tx->next;
+	} else if (q->next == tx) {
+		q->next = tx->next;
+	}
+
+	q->len--;
+	q->bytes -= tx->len;
+
+	tx->status = status;
+	tx->next = NULL;
+	if (bus->tx_done_tail)
+		bus->tx_done_tail->next = tx;
+	else
+		bus->tx_done = tx;
+	bus->tx_done_tail = tx;
+}
+
+/* Release the messages on the done list. Callbacks may queue new
+ * messages, so this only runs between scheduling passes. */
+static void mctp_tx_flush_done(struct mctp_bus *bus)
+{
+	struct mctp_tx_msg *tx, *done;
+
+	mctp_lock(&bus->tx_lock);
+	done = bus->tx_done;
+	bus->tx_done = NULL;
+	bus->tx_done_tail = NULL;
+	mctp_unlock(&bus->tx_lock);
+
+	if (!done)
 		return;
+
+	while ((tx = done)) {
+		done = tx->next;
+		mctp_tx_msg_release(bus->mctp, tx, tx->status);
 	}
 
-	bus->tx_seq = (bus->tx_seq + 1) & MCTP_HDR_SEQ_MASK;
-	bus->tx_msgpos += bus->tx_pktlen;
+	/* Held requests may have been waiting for queue room */
+	mctp_lock(&bus->mctp->tag_lock);
+	if (bus->mctp->req_pending)
+		bus->mctp->req_pending_ready = true;
+	mctp_unlock(&bus->mctp->tag_lock);
+	mctp_req_pending_run(bus->mctp);
+}
+
+/* The next packet of @tx, picked by the scheduler, has been sent */
+static void mctp_tx_sent(struct mctp_bus *bus, struct mctp_tx_msg *tx)
+{
+	mctp_tx_advance(bus, tx);
+	tx->pos = tx->next_pos;
+	tx->seq = tx->next_seq;
+	if (tx->next_done)
+		mctp_tx_msg_done(bus, tx, 0);
+}
+
+/* Settle a batch of @n packets once the binding has taken the first
+ * @sent. Messages may have been queued during the call, so rather than
+ * picking again this uses the messages and scheduler state recorded as
+ * the packets were built: the scheduler resumes at the first packet not
+ * taken, and each message moves past the packets taken. */
+static void mctp_tx_batch_settle(struct mctp_bus *bus, size_t n, size_t sent)
+{
+	struct mctp_tx_batch_ent *ents = bus->tx_batch_ents;
+	struct mctp_tx_msg *tx;
+	size_t i;
 
-	if (bus->tx_msgpos >= bus->tx_msglen) {
-		__mctp_msg_free(bus->tx_msg, bus->binding->mctp);
-		bus->tx_msg = NULL;
+	for (i = 0; i < n; i++) {
+		ents[i].tx->next_pos = ents[i].tx->pos;
+		ents[i].tx->next_seq = ents[i].tx->seq;
+		ents[i].tx->next_done = false;
+	}
+	if (sent < n)
+		mctp_tx_sched_restore(bus, &ents[sent].sched);
+
+	for (i = 0; i < sent; i++) {
+		tx = ents[i].tx;
+		tx->next_pos += mctp_tx_pktlen(bus, tx, tx->next_pos);
+		tx->next_seq = (tx->next_seq + 1) & MCTP_HDR_SEQ_MASK;
+		tx->pos = tx->next_pos;
+		tx->seq = tx->next_seq;
+		if (tx->pos >= tx->len) {
+			tx->next_done = true;
+			mctp_tx_msg_done(bus, tx, 0);
+		}
 	}
 }
 
-static void mctp_send_tx_queue(struct mctp_bus *bus)
+/* Send one packet through the binding's tx or tx_gather op. Returns 0 if
+ * the queue made progress, or -EBUSY. */
+static int mctp_send_tx_one(struct mctp_bus *bus)
 {
+	struct mctp_tx_sched sched;
 	struct mctp_pktbuf *pkt;
+	struct mctp_tx_msg *tx;
+	const void *payload = NULL;
+	struct mctp_hdr hdr;
+	size_t payload_len;
+	int rc;
+
+	mctp_tx_sched_save(bus, &sched);
+	tx = mctp_tx_pick(bus);
+
+	/* Captures need the packet in a pktbuf, as do packets that span
+	 * regions of the message */
+	if (bus->binding->tx_gather && !bus->mctp->capture)
+		payload = mctp_tx_contig(tx, tx->next_pos,
+					 mctp_tx_pktlen(bus, tx, tx->next_pos));
+
+	if (payload)
+		payload_len = mctp_tx_hdr(bus, tx, tx->next_pos, tx->next_seq,
+					  &hdr);
+	else
+		pkt = mctp_tx_pkt(bus, tx, tx->next_pos, tx->next_seq,
+				  bus->binding->tx_storage);
+
+	/* The binding may block, so is called without the lock. tx_active
+	 * keeps other senders off the bus, and only this one removes
+	 * messages from the queue. */
+	mctp_unlock(&bus->tx_lock);
+	if (payload)
+		rc = bus->binding->tx_gather(bus->binding, &hdr, payload,
+					     payload_len);
+	else
+		rc = mctp_packet_tx(bus, pkt);
+	mctp_lock(&bus->tx_lock);
+
+	switch (rc) {
+	/* If transmission succeded */
+	case 0:
+		mctp_tx_sent(bus, tx);
+		return 0;
 
-	while (bus->tx_msg && bus->state == mctp_bus_state_tx_enabled) {
-		int rc;
+	/* If the binding was busy */
+	case -EBUSY:
+		/* Keep the packet for next try, and its turn */
+		mctp_tx_sched_restore(bus, &sched);
+		return -EBUSY;
 
-		pkt = mctp_next_tx_pkt(bus);
+	/* Some other unknown error occurred */
+	default:
+		/* Drop the rest of the message */
+		mctp_prdebug("tx drop %d", rc);
+		mctp_tx_sched_restore(bus, &sched);
+		mctp_tx_msg_done(bus, tx, rc);
+		return 0;
+	}
+}
 
-		rc = mctp_packet_tx(bus, pkt);
-		switch (rc) {
-		/* If transmission succeded */
-		case 0:
-			/* Drop the packet */
-			mctp_tx_complete(bus);
-			break;
+/* Storage for the packets of one tx_batch call, allocated on first use */
+static int mctp_tx_batch_init(struct mctp_bus *bus)
+{
+	struct mctp_binding *binding = bus->binding;
+	size_t i, n;
+
+	n = binding->tx_batch_max ? binding->tx_batch_max : MCTP_TX_BATCH;
+	bus->tx_batch_slot = sizeof(struct mctp_pktbuf) + binding->pkt_size +
+			     binding->pkt_header + binding->pkt_trailer;
+	/* Keep each slot aligned for struct mctp_pktbuf */
+	bus->tx_batch_slot += alignof(struct mctp_pktbuf) - 1;
+	bus->tx_batch_slot -= bus->tx_batch_slot % alignof(struct mctp_pktbuf);
+
+	bus->tx_batch_pkts = __mctp_alloc(n * sizeof(*bus->tx_batch_pkts));
+	bus->tx_batch_ents = __mctp_alloc(n * sizeof(*bus->tx_batch_ents));
+	bus->tx_batch_storage = __mctp_alloc(n * bus->tx_batch_slot);
+	if (!bus->tx_batch_pkts || !bus->tx_batch_ents ||
+	    !bus->tx_batch_storage) {
+		if (bus->tx_batch_pkts)
+			__mctp_free(bus->tx_batch_pkts);
+		if (bus->tx_batch_ents)
+			__mctp_free(bus->tx_batch_ents);
+		if (bus->tx_batch_storage)
+			__mctp_free(bus->tx_batch_storage);
+		bus->tx_batch_pkts = NULL;
+		bus->tx_batch_ents = NULL;
+		bus->tx_batch_storage = NULL;
+		return -ENOMEM;
+	}
 
-		/* If the binding was busy */
-		case -EBUSY:
-			/* Keep the packet for next try */
-			mctp_prdebug("tx EBUSY");
-			return;
+	for (i = 0; i < n; i++)
+		bus->tx_batch_pkts[i] = NULL;
+	bus->tx_batch_max = n;
+
+	return 0;
+}
 
-		/* Some other unknown error occurred */
-		default:
-			/* Drop the packet */
+/* Packetize up to tx_batch_max packets ahead of the queue, in schedule
+ * order, and pass them to the binding in one call. Returns 0 if the queue
+ * made progress, or -EBUSY if the binding took only part of the batch. */
+static int mctp_send_tx_batch(struct mctp_bus *bus)
+{
+	struct mctp_binding *binding = bus->binding;
+	struct mctp *mctp = bus->mctp;
+	struct mctp_tx_batch_ent *ent;
+	struct mctp_tx_sched sched;
+	struct mctp_tx_msg *tx;
+	size_t i, n = 0;
+	int rc;
+
+	if (!bus->tx_batch_pkts) {
+		rc = mctp_tx_batch_init(bus);
+		if (rc) {
+			/* Nothing would be in flight to resume the queue, so
+			 * send single packets through tx until the storage
+			 * can be had, or fail the next message */
+			if (binding->tx && binding->tx_storage)
+				return mctp_send_tx_one(bus);
+
+			mctp_tx_sched_save(bus, &sched);
+			tx = mctp_tx_pick(bus);
+			mctp_tx_sched_restore(bus, &sched);
+			if (!tx)
+				return -EBUSY;
 			mctp_prdebug("tx drop %d", rc);
-			mctp_tx_complete(bus);
-			return;
-		};
+			mctp_tx_msg_done(bus, tx, rc);
+			return 0;
+		}
+	}
+
+	while (n < bus->tx_batch_max) {
+		void *storage = (uint8_t *)bus->tx_batch_storage +
+				n * bus->tx_batch_slot;
+
+		ent = &bus->tx_batch_ents[n];
+		mctp_tx_sched_save(bus, &ent->sched);
+		ent->tx = mctp_tx_pick(bus);
+		if (!ent->tx) {
+			mctp_tx_sched_restore(bus, &ent->sched);
+			break;
+		}
+		bus->tx_batch_pkts[n++] = mctp_tx_pkt(bus, ent->tx,
+						      ent->tx->next_pos,
+						      ent->tx->next_seq, storage);
+		mctp_tx_advance(bus, ent->tx);
+	}
+
+	mctp_unlock(&bus->tx_lock);
+	rc = binding->tx_batch(binding, bus->tx_batch_pkts, n);
+	mctp_lock(&bus->tx_lock);
+
+	if (rc == -EBUSY) {
+		mctp_tx_batch_settle(bus, n, 0);
+		return -EBUSY;
 	}
+
+	if (rc < 0) {
+		/* Drop the rest of the message the batch started with */
+		mctp_prdebug("tx drop %d", rc);
+		mctp_tx_batch_settle(bus, n, 0);
+		mctp_tx_msg_done(bus, bus->tx_batch_ents[0].tx, rc);
+		return 0;
+	}
+
+	for (i = 0; i < MIN((size_t)rc, n); i++) {
+		if (mctp->capture)
+			mctp->capture(bus->tx_batch_pkts[i],
+				      MCTP_MESSAGE_CAPTURE_OUTGOING,
+				      mctp->capture_data);
+	}
+	mctp_tx_batch_settle(bus, n, MIN((size_t)rc, n));
+
+	return (size_t)rc < n ? -EBUSY : 0;
 }
 
-void mctp_binding_set_tx_enabled(struct mctp_binding *binding, bool enable)
+static void mctp_send_tx_queue(struct mctp_bus *bus)
 {
-	struct mctp_bus *bus = binding->bus;
+	int rc;
+
+	mctp_lock(&bus->tx_lock);
+
+	/* Messages queued from within tx(), for example by an RX callback on
+	 * a loopback binding, or by another thread, are picked up by the
+	 * running loop */
+	if (bus->tx_active) {
+		mctp_unlock(&bus->tx_lock);
+		return;
+	}
+	bus->tx_active = true;
+
+	while ((bus->tx_queues[MCTP_TX_CLASS_URGENT].head ||
+		bus->tx_queues[MCTP_TX_CLASS_BULK].head) &&
+	       bus->state == mctp_bus_state_tx_enabled) {
+		if (bus->binding->tx_batch)
+			rc = mctp_send_tx_batch(bus);
+		else
+			rc = mctp_send_tx_one(bus);
+
+		if (bus->tx_done) {
+			mctp_unlock(&bus->tx_lock);
+			mctp_tx_flush_done(bus);
+			mctp_lock(&bus->tx_lock);
+		}
+
+		if (rc == -EBUSY) {
+			mctp_prdebug("tx EBUSY");
+			break;
+		}
+	}
+
+	bus->tx_active = false;
+	mctp_unlock(&bus->tx_lock);
+}
+
+static void mctp_bus_set_tx_state(struct mctp_bus *bus, bool enable)
+{
+	struct mctp_binding *binding = bus->binding;
 
 	switch (bus->state) {
 	case mctp_bus_state_constructed:
@@ -857,16 +2456,83 @@ void mctp_binding_set_tx_enabled(struct mctp_binding *binding, bool enable)
 
 		bus->state = mctp_bus_state_tx_enabled;
 		mctp_prdebug("%s binding Tx enabled", binding->name);
-		mctp_send_tx_queue(bus);
 		return;
 	}
 }
 
+void mctp_binding_set_tx_enabled(struct mctp_binding *binding, bool enable)
+{
+	struct mctp_bus *bus = binding->bus;
+
+	mctp_lock(&bus->tx_lock);
+	mctp_bus_set_tx_state(bus, enable);
+	mctp_unlock(&bus->tx_lock);
+
+	if (enable)
+		mctp_send_tx_queue(bus);
+}
+
+/* A message is always accepted onto an empty queue, so that one larger
+ * than the byte budget can still be sent */
+static bool mctp_tx_queue_has_room(struct mctp_bus *bus,
+				   enum mctp_tx_class tx_class, size_t msg_len)
+{
+	const struct mctp_tx_queue *q = &bus->tx_queues[tx_class];
+	size_t depth = bus->mctp->tx_queue_depth[tx_class];
+	size_t bytes = bus->mctp->tx_queue_bytes[tx_class];
+	bool room;
+
+	mctp_lock(&bus->tx_lock);
+	room = !q->len ||
+	       (q->len < depth && msg_len <= bytes - MIN(q->bytes, bytes));
+	mctp_unlock(&bus->tx_lock);
+
+	return room;
+}
+
+/* MCTP control messages are always sent in the urgent class */
+static enum mctp_tx_class mctp_tx_msg_class(const void *msg, size_t msg_len,
+					    enum mctp_tx_class tx_class)
+{
+	if (msg_len && (*(const uint8_t *)msg & MCTP_MSG_TYPE_MASK) ==
+			       MCTP_CTRL_HDR_MSG_TYPE)
+		return MCTP_TX_CLASS_URGENT;
+
+	return tx_class;
+}
+
+/* The same for a message given as @iovcnt regions */
+static enum mctp_tx_class mctp_tx_iov_class(const struct mctp_iovec *iov,
+					    size_t iovcnt,
+					    enum mctp_tx_class tx_class)
+{
+	size_t i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].len)
+			return mctp_tx_msg_class(iov[i].base, iov[i].len,
+						 tx_class);
+	}
+
+	return tx_class;
+}
+
+/* Queue the message held in @iovcnt regions at @iov. @msg is the buffer
+ * to free once it is sent, or on failure, and NULL for borrowed regions.
+ * The region list itself is copied. @cont is NULL for a new message. */
 static int mctp_message_tx_on_bus(struct mctp_bus *bus, mctp_eid_t src,
 				  mctp_eid_t dest, bool tag_owner,
-				  uint8_t msg_tag, void *msg, size_t msg_len)
+				  uint8_t msg_tag, const struct mctp_iovec *iov,
+				  size_t iovcnt, void *msg,
+				  const struct mctp_tx_opts *opts,
+				  const struct mctp_tx_cont *cont)
 {
+	enum mctp_tx_class tx_class;
+	struct mctp_tx_queue *q;
+	struct mctp_tx_msg *tx;
 	size_t max_payload_len;
+	size_t msg_len = 0;
+	size_t i;
 	int rc;
 
 	if (bus->state == mctp_bus_state_constructed) {
@@ -890,61 +2556,165 @@ static int mctp_message_tx_on_bus(struct mctp_bus *bus, mctp_eid_t src,
 		}
 	}
 
+	for (i = 0; i < iovcnt; i++)
+		msg_len += iov[i].len;
+
 	mctp_prdebug(
 		"%s: Generating packets for transmission of %zu byte message from %hhu to %hhu",
 		__func__, msg_len, src, dest);
 
-	if (bus->tx_msg) {
-		mctp_prdebug("Bus busy");
+	tx_class = mctp_tx_iov_class(
+		iov, iovcnt, opts ? opts->tx_class : MCTP_TX_CLASS_BULK);
+	q = &bus->tx_queues[tx_class];
+	mctp_lock(&bus->tx_lock);
+	if (!mctp_tx_queue_has_room(bus, tx_class, msg_len)) {
+		mctp_prdebug("TX queue %d full: %zu messages, %zu bytes",
+			     tx_class, q->len, q->bytes);
+		mctp_unlock(&bus->tx_lock);
 		rc = -EBUSY;
 		goto err;
 	}
 
+	tx = __mctp_alloc(sizeof(*tx) + iovcnt * sizeof(*iov));
+	if (!tx) {
+		mctp_unlock(&bus->tx_lock);
+		rc = -ENOMEM;
+		goto err;
+	}
+
 	/* Take the message to send */
-	bus->tx_msg = msg;
-	bus->tx_msglen = msg_len;
-	bus->tx_msgpos = 0;
-	/* bus->tx_seq is allowed to continue from previous message */
-	bus->tx_src = src;
-	bus->tx_dest = dest;
-	bus->tx_to = tag_owner;
-	bus->tx_tag = msg_tag;
+	tx->next = NULL;
+	tx->msg = msg;
+	memcpy(tx->iov, iov, iovcnt * sizeof(*iov));
+	tx->iovcnt = iovcnt;
+	tx->len = msg_len;
+	tx->pos = 0;
+	tx->seq = cont ? cont->seq : 0;
+	tx->next_pos = 0;
+	tx->next_seq = tx->seq;
+	tx->next_done = false;
+	tx->cont_len = cont ? cont->pkt_len : 0;
+	tx->src = src;
+	tx->dest = dest;
+	tx->tag_owner = tag_owner;
+	tx->tag = msg_tag;
+	tx->tx_class = tx_class;
+	tx->done = opts ? opts->done : NULL;
+	tx->done_data = opts ? opts->done_data : NULL;
+	tx->start = 0;
+	if (tx->done && bus->mctp->platform_now)
+		tx->start = mctp_now(bus->mctp);
+
+	if (q->tail)
+		q->tail->next = tx;
+	else
+		q->head = tx;
+	q->tail = tx;
+	q->len++;
+	q->bytes += msg_len;
+	mctp_unlock(&bus->tx_lock);
 
 	mctp_send_tx_queue(bus);
 	return 0;
 
 err:
-	__mctp_msg_free(msg, bus->binding->mctp);
+	if (msg)
+		__mctp_msg_free(msg, bus->binding->mctp);
 	return rc;
 }
 
-int mctp_message_tx_alloced(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
-			    uint8_t msg_tag, void *msg, size_t msg_len)
+/* Queue a message for @eid, as for mctp_message_tx_on_bus() */
+static int mctp_message_tx_eid(struct mctp *mctp, mctp_eid_t eid,
+			       bool tag_owner, uint8_t msg_tag,
+			       const struct mctp_iovec *iov, size_t iovcnt,
+			       void *msg, const struct mctp_tx_opts *opts)
 {
 	struct mctp_bus *bus;
+	int rc = 0;
+
+	if (opts && (unsigned)opts->tx_class >= MCTP_TX_CLASSES) {
+		rc = -EINVAL;
+		goto err;
+	}
 
 	/* TODO: Protect against same tag being used across
 	 * different callers */
 	if ((msg_tag & MCTP_HDR_TAG_MASK) != msg_tag) {
 		mctp_prerr("Incorrect message tag %u passed.", msg_tag);
-		__mctp_msg_free(msg, mctp);
-		return -EINVAL;
+		rc = -EINVAL;
+		goto err;
 	}
 
 	bus = find_bus_for_eid(mctp, eid);
 	if (!bus) {
-		__mctp_msg_free(msg, mctp);
-		return 0;
+		if (opts && opts->done)
+			opts->done(-EHOSTUNREACH, 0, 0, opts->done_data);
+		goto err;
 	}
 
 	return mctp_message_tx_on_bus(bus, bus->eid, eid, tag_owner, msg_tag,
-				      msg, msg_len);
+				      iov, iovcnt, msg, opts, NULL);
+
+err:
+	if (msg)
+		__mctp_msg_free(msg, mctp);
+	return rc;
+}
+
+int mctp_message_tx_opts(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
+			 uint8_t msg_tag, void *msg, size_t msg_len,
+			 const struct mctp_tx_opts *opts)
+{
+	struct mctp_iovec iov = { msg, msg_len };
+
+	return mctp_message_tx_eid(mctp, eid, tag_owner, msg_tag, &iov, 1, msg,
+				   opts);
+}
+
+int mctp_message_tx_borrowed(struct mctp *mctp, mctp_eid_t eid,
+			     bool tag_owner, uint8_t msg_tag, const void *msg,
+			     size_t msg_len, const struct mctp_tx_opts *opts)
+{
+	struct mctp_iovec iov = { msg, msg_len };
+
+	return mctp_message_tx_iov(mctp, eid, tag_owner, msg_tag, &iov, 1,
+				   opts);
+}
+
+int mctp_message_tx_iov(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
+			uint8_t msg_tag, const struct mctp_iovec *iov,
+			size_t iovcnt, const struct mctp_tx_opts *opts)
+{
+	/* The caller needs to know when it has the buffers back */
+	if (!opts || !opts->done)
+		return -EINVAL;
+
+	return mctp_message_tx_eid(mctp, eid, tag_owner, msg_tag, iov, iovcnt,
+				   NULL, opts);
+}
+
+int mctp_message_tx_alloced(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
+			    uint8_t msg_tag, void *msg, size_t msg_len)
+{
+	return mctp_message_tx_opts(mctp, eid, tag_owner, msg_tag, msg,
+				    msg_len, NULL);
 }
 
 int mctp_message_tx(struct mctp *mctp, mctp_eid_t eid, bool tag_owner,
 		    uint8_t msg_tag, const void *msg, size_t msg_len)
 {
-	void *copy = mctp_msg_dup(msg, msg_len, mctp);
+	struct mctp_bus *bus;
+	void *copy;
+
+	/* Don't copy a message that can't be queued */
+	bus = find_bus_for_eid(mctp, eid);
+	if (bus && bus->state != mctp_bus_state_constructed &&
+	    !mctp_tx_queue_has_room(
+		    bus, mctp_tx_msg_class(msg, msg_len, MCTP_TX_CLASS_BULK),
+		    msg_len))
+		return -EBUSY;
+
+	copy = mctp_msg_dup(msg, msg_len, mctp);
 	if (!copy) {
 		return -ENOMEM;
 	}
@@ -966,58 +2736,153 @@ uint64_t mctp_now(struct mctp *mctp)
 	return mctp->platform_now(mctp->platform_now_ctx);
 }
 
-static void mctp_dealloc_tag(struct mctp_bus *bus, mctp_eid_t local,
-			     mctp_eid_t remote, uint8_t tag)
+/* Free the req_tags entry @idx and its tag */
+static void mctp_req_tag_release(struct mctp *mctp, uint16_t idx)
 {
-	struct mctp *mctp = bus->binding->mctp;
+	struct mctp_req_tag *r = &mctp->req_tags[idx];
+	struct mctp_bus *bus = &mctp->busses[r->bus];
+
+	if (r->prev)
+		mctp->req_tags[r->prev - 1].next = r->next;
+	else
+		mctp->req_tag_head = r->next;
+	if (r->next)
+		mctp->req_tags[r->next - 1].prev = r->prev;
+	else
+		mctp->req_tag_tail = r->prev;
+
+	bus->req_tags_used[r->remote] &= ~(1 << r->tag);
+	bus->req_tag_slot[r->remote][r->tag] = 0;
+	mctp->req_tag_free[mctp->n_req_tag_free++] = idx;
+
+	if (mctp->req_pending)
+		mctp->req_pending_ready = true;
+}
+
+/* Free the req_tags entry @idx of a request that got no response, and
+ * report @status to its response callback */
+static void mctp_req_tag_fail(struct mctp *mctp, uint16_t idx, int status)
+{
+	struct mctp_req_tag *r = &mctp->req_tags[idx];
+	mctp_resp_fn fn = r->fn;
+	mctp_eid_t remote = r->remote;
+	uint8_t tag = r->tag;
+	void *data = r->data;
+
+	mctp_req_tag_release(mctp, idx);
+	if (fn)
+		fn(remote, tag, status, NULL, 0, data);
+}
+
+/* Free the tags that expired before @now, from the head of the list */
+static void mctp_req_tag_expire(struct mctp *mctp, uint64_t now)
+{
+	while (mctp->req_tag_head &&
+	       mctp->req_tags[mctp->req_tag_head - 1].expiry < now)
+		mctp_req_tag_fail(mctp, mctp->req_tag_head - 1, -ETIMEDOUT);
+}
+
+void mctp_check_timeouts(struct mctp *mctp)
+{
+	mctp_lock(&mctp->tag_lock);
+	if (mctp->platform_now && mctp->req_tag_head)
+		mctp_req_tag_expire(mctp, mctp_now(mctp));
+	mctp_unlock(&mctp->tag_lock);
+
+	mctp_req_pending_run(mctp);
+}
+
+/* The allocated tag @tag from @local to @remote, or NULL */
+static struct mctp_req_tag *mctp_req_tag_lookup(struct mctp *mctp,
+						mctp_eid_t local,
+						mctp_eid_t remote,
+						uint8_t tag)
+{
+	struct mctp_bus *bus;
+	uint16_t idx;
+
 	if (local == 0) {
-		return;
+		return NULL;
 	}
 
-	for (size_t i = 0; i < ARRAY_SIZE(mctp->req_tags); i++) {
-		struct mctp_req_tag *r = &mctp->req_tags[i];
-		if (r->local == local && r->remote == remote && r->tag == tag) {
-			r->local = 0;
-			r->remote = 0;
-			r->tag = 0;
-			r->expiry = 0;
-			return;
-		}
-	}
+	/* The tag is held by the bus the request was routed to */
+	bus = find_bus_for_eid(mctp, remote);
+	if (!bus || bus->eid != local)
+		return NULL;
+
+	idx = bus->req_tag_slot[remote][tag & MCTP_HDR_TAG_MASK];
+	return idx ? &mctp->req_tags[idx - 1] : NULL;
 }
 
-static int mctp_alloc_tag(struct mctp *mctp, mctp_eid_t local,
-			  mctp_eid_t remote, uint8_t *ret_tag)
+/* Free the tag of a response. Returns the response callback of the
+ * request, with its data in @data, or NULL. */
+static mctp_resp_fn mctp_dealloc_tag(struct mctp_bus *bus, mctp_eid_t local,
+				     mctp_eid_t remote, uint8_t tag,
+				     void **data)
 {
-	assert(local != 0);
-	uint64_t now = mctp_now(mctp);
-
-	uint8_t used = 0;
-	struct mctp_req_tag *spare = NULL;
-	/* Find which tags and slots are used/spare */
-	for (size_t i = 0; i < ARRAY_SIZE(mctp->req_tags); i++) {
-		struct mctp_req_tag *r = &mctp->req_tags[i];
-		if (r->local == 0 || r->expiry < now) {
-			spare = r;
-		} else {
-			if (r->local == local && r->remote == remote) {
-				used |= 1 << r->tag;
-			}
-		}
+	struct mctp *mctp = bus->mctp;
+	struct mctp_req_tag *r;
+	mctp_resp_fn fn = NULL;
+
+	mctp_lock(&mctp->tag_lock);
+	r = mctp_req_tag_lookup(mctp, local, remote, tag);
+	if (r) {
+		fn = r->fn;
+		if (data)
+			*data = r->data;
+		mctp_req_tag_release(mctp, (uint16_t)(r - mctp->req_tags));
+		mctp->rx_tag_freed = true;
 	}
+	mctp_unlock(&mctp->tag_lock);
+
+	return fn;
+}
 
-	if (spare == NULL) {
+/* Allocate a tag, with the expired ones already freed at @now. Called
+ * with the tag lock held. */
+static int mctp_alloc_tag_at(struct mctp *mctp, struct mctp_bus *bus,
+			     mctp_eid_t remote, uint64_t now,
+			     uint8_t *ret_tag, mctp_resp_fn fn, void *data)
+{
+	assert(bus->eid != 0);
+	struct mctp_req_tag *r;
+	uint16_t idx;
+	uint8_t used;
+
+	if (!mctp->n_req_tag_free) {
 		// All req_tag slots are in-use
 		return -EBUSY;
 	}
 
+	used = bus->req_tags_used[remote];
 	for (uint8_t t = 0; t < 8; t++) {
 		uint8_t tag = (t + mctp->tag_round_robin) % 8;
+		if (mctp->tag_filter &&
+		    !mctp->tag_filter(remote, tag, mctp->tag_filter_data))
+			continue;
 		if ((used & 1 << tag) == 0) {
-			spare->local = local;
-			spare->remote = remote;
-			spare->tag = tag;
-			spare->expiry = now + MCTP_TAG_TIMEOUT;
+			idx = mctp->req_tag_free[--mctp->n_req_tag_free];
+			r = &mctp->req_tags[idx];
+			r->local = bus->eid;
+			r->remote = remote;
+			r->tag = tag;
+			r->bus = (uint8_t)(bus - mctp->busses);
+			r->expiry = now + MCTP_TAG_TIMEOUT;
+			r->fn = fn;
+			r->data = data;
+
+			/* Timeouts are all equal, so append in expiry order */
+			r->next = 0;
+			r->prev = mctp->req_tag_tail;
+			if (mctp->req_tag_tail)
+				mctp->req_tags[mctp->req_tag_tail - 1].next =
+					idx + 1;
+			else
+				mctp->req_tag_head = idx + 1;
+			mctp->req_tag_tail = idx + 1;
+
+			bus->req_tags_used[remote] |= 1 << tag;
+			bus->req_tag_slot[remote][tag] = idx + 1;
 			*ret_tag = tag;
 			mctp->tag_round_robin = (tag + 1) % 8;
 			return 0;
@@ -1028,20 +2893,248 @@ static int mctp_alloc_tag(struct mctp *mctp, mctp_eid_t local,
 	return -EBUSY;
 }
 
-int mctp_message_tx_request(struct mctp *mctp, mctp_eid_t eid, void *msg,
-			    size_t msg_len, uint8_t *ret_alloc_msg_tag)
+/* Called with the tag lock held */
+static int mctp_alloc_tag(struct mctp *mctp, struct mctp_bus *bus,
+			  mctp_eid_t remote, uint8_t *ret_tag, mctp_resp_fn fn,
+			  void *data)
+{
+	uint64_t now = mctp_now(mctp);
+
+	mctp_req_tag_expire(mctp, now);
+	return mctp_alloc_tag_at(mctp, bus, remote, now, ret_tag, fn, data);
+}
+
+/* Queue @msg on @bus as a request with the allocated tag @tag, freeing
+ * the tag again if that fails */
+static int mctp_req_tx(struct mctp *mctp, struct mctp_bus *bus,
+		       mctp_eid_t eid, uint8_t tag, void *msg, size_t len)
 {
+	struct mctp_req_tag *r;
 	int rc;
+
+	rc = mctp_message_tx_alloced(mctp, eid, true, tag, msg, len);
+	if (rc) {
+		/* Not sent, so no response will come */
+		mctp_lock(&mctp->tag_lock);
+		r = mctp_req_tag_lookup(mctp, bus->eid, eid, tag);
+		if (r)
+			mctp_req_tag_release(mctp,
+					     (uint16_t)(r - mctp->req_tags));
+		mctp_unlock(&mctp->tag_lock);
+	}
+
+	return rc;
+}
+
+/* Whether the TX queue of @bus has room for a request */
+static bool mctp_req_has_room(struct mctp_bus *bus, const void *msg,
+			      size_t len)
+{
+	return bus->state == mctp_bus_state_constructed ||
+	       mctp_tx_queue_has_room(
+		       bus, mctp_tx_msg_class(msg, len, MCTP_TX_CLASS_BULK),
+		       len);
+}
+
+static bool mctp_req_pending_has(struct mctp *mctp, struct mctp_bus *bus,
+				 mctp_eid_t eid)
+{
+	struct mctp_req_pending *p;
+
+	for (p = mctp->req_pending; p; p = p->next) {
+		if (p->eid == eid && &mctp->busses[p->bus] == bus)
+			return true;
+	}
+
+	return false;
+}
+
+/* Hold a request until a tag to @eid is freed */
+static int mctp_req_pending_add(struct mctp *mctp, struct mctp_bus *bus,
+				mctp_eid_t eid, void *msg, size_t len,
+				mctp_resp_fn fn, void *data)
+{
+	struct mctp_req_pending *p;
+
+	if (mctp->req_stats.pending >= mctp->req_pending_limit) {
+		mctp->req_stats.rejected++;
+		return -EBUSY;
+	}
+
+	p = __mctp_alloc(sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	p->next = NULL;
+	p->msg = msg;
+	p->len = len;
+	p->eid = eid;
+	p->bus = (uint8_t)(bus - mctp->busses);
+	p->fn = fn;
+	p->data = data;
+
+	if (mctp->req_pending_tail)
+		mctp->req_pending_tail->next = p;
+	else
+		mctp->req_pending = p;
+	mctp->req_pending_tail = p;
+
+	mctp->req_stats.queued++;
+	mctp->req_stats.pending++;
+	mctp->req_stats.max_pending =
+		MAX(mctp->req_stats.max_pending, mctp->req_stats.pending);
+	return 0;
+}
+
+static void mctp_req_pending_unlink(struct mctp *mctp,
+				    struct mctp_req_pending *prev,
+				    struct mctp_req_pending *p)
+{
+	if (prev)
+		prev->next = p->next;
+	else
+		mctp->req_pending = p->next;
+	if (mctp->req_pending_tail == p)
+		mctp->req_pending_tail = prev;
+	mctp->req_stats.pending--;
+}
+
+/* Send the held requests that can get a tag now, oldest first, if
+ * capacity was freed since they were last tried. A request that can't be
+ * sent holds back the later ones to its peer. Sends and callbacks may
+ * free more tags, which needs another pass for the peers passed over. */
+static void mctp_req_pending_run(struct mctp *mctp)
+{
+	struct mctp_req_pending *p, *prev;
+	uint8_t blocked[256 / 8];
+	struct mctp_bus *bus;
+	unsigned int gen;
+	uint64_t now;
+	uint8_t tag;
+	int rc;
+
+	mctp_lock(&mctp->tag_lock);
+	if (!mctp->req_pending_ready || mctp->req_pending_active) {
+		mctp_unlock(&mctp->tag_lock);
+		return;
+	}
+	mctp->req_pending_active = true;
+
+	while (mctp->req_pending_ready) {
+		mctp->req_pending_ready = false;
+		memset(blocked, 0, sizeof(blocked));
+		now = mctp_now(mctp);
+		mctp_req_tag_expire(mctp, now);
+
+		prev = NULL;
+		p = mctp->req_pending;
+		while (p) {
+			bus = &mctp->busses[p->bus];
+			if ((blocked[p->eid / 8] & (1 << (p->eid % 8))) ||
+			    !mctp_req_has_room(bus, p->msg, p->len) ||
+			    mctp_alloc_tag_at(mctp, bus, p->eid, now, &tag,
+					      p->fn, p->data)) {
+				blocked[p->eid / 8] |= 1 << (p->eid % 8);
+				prev = p;
+				p = p->next;
+				continue;
+			}
+
+			mctp_req_pending_unlink(mctp, prev, p);
+			gen = mctp->req_pending_gen;
+
+			/* Send without the lock, as it reaches the binding.
+			 * req_pending_active keeps other runs out. */
+			mctp_unlock(&mctp->tag_lock);
+			rc = mctp_req_tx(mctp, bus, p->eid, tag, p->msg, p->len);
+			if (rc)
+				p->fn(p->eid, tag, rc, NULL, 0, p->data);
+			__mctp_free(p);
+			mctp_lock(&mctp->tag_lock);
+
+			/* Carry on after @prev, unless requests were
+			 * cancelled meanwhile and it may be gone */
+			if (gen != mctp->req_pending_gen) {
+				mctp->req_pending_ready = true;
+				break;
+			}
+			p = prev ? prev->next : mctp->req_pending;
+		}
+	}
+
+	mctp->req_pending_active = false;
+	mctp_unlock(&mctp->tag_lock);
+}
+
+/* Cancel the held requests made on @bus */
+static void mctp_req_pending_cancel(struct mctp *mctp, struct mctp_bus *bus)
+{
+	struct mctp_req_pending *p, *prev = NULL;
+	unsigned int gen;
+
+	p = mctp->req_pending;
+	while (p) {
+		if (&mctp->busses[p->bus] != bus) {
+			prev = p;
+			p = p->next;
+			continue;
+		}
+
+		mctp_req_pending_unlink(mctp, prev, p);
+		gen = ++mctp->req_pending_gen;
+		__mctp_msg_free(p->msg, mctp);
+		p->fn(p->eid, MCTP_TAG_PENDING, -ECANCELED, NULL, 0, p->data);
+		__mctp_free(p);
+
+		/* A nested cancel may have freed @prev */
+		if (gen != mctp->req_pending_gen)
+			prev = NULL;
+		p = prev ? prev->next : mctp->req_pending;
+	}
+}
+
+int mctp_message_tx_request_cb(struct mctp *mctp, mctp_eid_t eid, void *msg,
+			       size_t msg_len, uint8_t *ret_alloc_msg_tag,
+			       mctp_resp_fn fn, void *data)
+{
 	struct mctp_bus *bus;
+	uint8_t alloc_tag;
+	int rc;
 
 	bus = find_bus_for_eid(mctp, eid);
 	if (!bus) {
 		__mctp_msg_free(msg, mctp);
+		if (fn)
+			fn(eid, 0, -EHOSTUNREACH, NULL, 0, data);
 		return 0;
 	}
 
-	uint8_t alloc_tag;
-	rc = mctp_alloc_tag(mctp, bus->eid, eid, &alloc_tag);
+	/* Don't tie up a tag for a message that can't be queued */
+	if (!mctp_req_has_room(bus, msg, msg_len)) {
+		__mctp_msg_free(msg, mctp);
+		return -EBUSY;
+	}
+
+	mctp_lock(&mctp->tag_lock);
+
+	/* Keep behind the requests already waiting for this peer */
+	if (fn && mctp_req_pending_has(mctp, bus, eid))
+		rc = -EBUSY;
+	else
+		rc = mctp_alloc_tag(mctp, bus, eid, &alloc_tag, fn, data);
+
+	/* Only a request with a callback can be told its tag later */
+	if (rc == -EBUSY && fn) {
+		rc = mctp_req_pending_add(mctp, bus, eid, msg, msg_len, fn,
+					  data);
+		if (!rc) {
+			mctp_unlock(&mctp->tag_lock);
+			if (ret_alloc_msg_tag)
+				*ret_alloc_msg_tag = MCTP_TAG_PENDING;
+			return 0;
+		}
+	}
+	mctp_unlock(&mctp->tag_lock);
 	if (rc) {
 		mctp_prdebug("Failed allocating tag");
 		__mctp_msg_free(msg, mctp);
@@ -1052,8 +3145,14 @@ int mctp_message_tx_request(struct mctp *mctp, mctp_eid_t eid, void *msg,
 		*ret_alloc_msg_tag = alloc_tag;
 	}
 
-	return mctp_message_tx_alloced(mctp, eid, true, alloc_tag, msg,
-				       msg_len);
+	return mctp_req_tx(mctp, bus, eid, alloc_tag, msg, msg_len);
+}
+
+int mctp_message_tx_request(struct mctp *mctp, mctp_eid_t eid, void *msg,
+			    size_t msg_len, uint8_t *ret_alloc_msg_tag)
+{
+	return mctp_message_tx_request_cb(mctp, eid, msg, msg_len,
+					  ret_alloc_msg_tag, NULL, NULL);
 }
 
 bool mctp_is_tx_ready(struct mctp *mctp, mctp_eid_t eid)
@@ -1064,7 +3163,32 @@ bool mctp_is_tx_ready(struct mctp *mctp, mctp_eid_t eid)
 	if (!bus) {
 		return true;
 	}
-	return bus->tx_msg == NULL;
+	return mctp_tx_queue_has_room(bus, MCTP_TX_CLASS_BULK, 0);
+}
+
+void *mctp_rx_msg_take(struct mctp *mctp)
+{
+	struct mctp_rx_msg *rx = &mctp->rx_msg;
+	void *buf;
+
+	if (!rx->valid) {
+		mctp_prdebug("no message to take");
+		return NULL;
+	}
+
+	if (rx->owner && rx->iovcnt == 1 && *rx->owner == rx->iov[0].base) {
+		/* Reassembled message: hand over the context buffer */
+		buf = *rx->owner;
+		*rx->owner = NULL;
+	} else {
+		buf = mctp_msg_linearize(rx->iov, rx->iovcnt, rx->len, mctp);
+		if (!buf)
+			return NULL;
+	}
+
+	rx->valid = false;
+	rx->owner = NULL;
+	return buf;
 }
 
 void *mctp_get_alloc_ctx(struct mctp *mctp)
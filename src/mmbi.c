@@ -3,13 +3,25 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#ifndef _WIN32
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
 
 #include "libmctp-mmbi.h"
 #include "libmctp-alloc.h"
 #include "libmctp-log.h"
 #include "container_of.h"
+#include "ring.h"
 
 #define BINDING_NAME "mmbi"
+#define MMBI_RX_BUF_SIZE (65536 + 10)
+/* Most pauses between checks of the wait handle while spinning */
+#define MMBI_SPIN_BACKOFF_MAX 64
 
 /*
  * MMBI binding implementation.
@@ -37,18 +49,66 @@ struct mctp_binding_mmbi *mctp_mmbi_init(void)
 	mmbi->binding.pkt_trailer = 0;
 
 #ifdef _WIN32
+	/* Manual reset, so a notify stays set until poll_wait takes it */
+	mmbi->wait_handle = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (!mmbi->wait_handle) {
+		__mctp_free(mmbi);
+		return NULL;
+	}
 	InitializeCriticalSection(&mmbi->lock);
+#elif defined(__linux__)
+	mmbi->wait_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mmbi->wait_handle < 0) {
+		__mctp_free(mmbi);
+		return NULL;
+	}
+#else
+	mmbi->wait_handle = -1;
 #endif
 
 	return mmbi;
 }
 
+/* Leave pipeline mode, dropping any packets still queued */
+static void mctp_mmbi_ring_free(struct mctp_binding_mmbi *mmbi)
+{
+	struct mctp_ring *ring = mmbi->rx_ring;
+	struct mctp_pktbuf *pkt;
+
+	if (!ring)
+		return;
+
+	mmbi->rx_ring = NULL;
+	while ((pkt = mctp_ring_pop(ring)))
+		mctp_pktbuf_free(pkt);
+	mctp_ring_destroy(ring);
+	__mctp_free(ring);
+}
+
 void mctp_mmbi_destroy(struct mctp_binding_mmbi *mmbi)
 {
 	if (!mmbi) return;
+	mctp_mmbi_ring_free(mmbi);
 #ifdef _WIN32
+	/* The read in flight targets rx_buf */
+	if (mmbi->rx_pending) {
+		DWORD bytesRead;
+
+		CancelIoEx((HANDLE)mmbi->device_handle, &mmbi->rx_ov);
+		GetOverlappedResult((HANDLE)mmbi->device_handle, &mmbi->rx_ov,
+				    &bytesRead, TRUE);
+	}
+	if (mmbi->rx_event)
+		CloseHandle(mmbi->rx_event);
+	if (mmbi->tx_event)
+		CloseHandle(mmbi->tx_event);
+	CloseHandle(mmbi->wait_handle);
 	DeleteCriticalSection(&mmbi->lock);
+#else
+	if (mmbi->wait_handle >= 0)
+		close(mmbi->wait_handle);
 #endif
+	__mctp_free(mmbi->rx_buf);
 	__mctp_free(mmbi);
 }
 
@@ -62,6 +122,14 @@ void mctp_mmbi_destroy(struct mctp_binding_mmbi *mmbi)
 // ... existing includes ...
 
 static int mctp_mmbi_start(struct mctp_binding *b);
+static uint64_t mctp_mmbi_now_us(void);
+
+/* A request sent is likely to be answered soon, so open the spin window */
+static void mctp_mmbi_tx_activity(struct mctp_binding_mmbi *mmbi)
+{
+	if (mmbi->spin_us)
+		mmbi->last_activity_us = mctp_mmbi_now_us();
+}
 
 static int mctp_mmbi_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
 {
@@ -72,6 +140,8 @@ static int mctp_mmbi_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
 	len = mctp_pktbuf_size(pkt);
 	buf = (void *)mctp_pktbuf_hdr(pkt);
 
+	mctp_mmbi_tx_activity(mmbi);
+
 #ifdef _WIN32
 	if (mmbi->device_handle && mmbi->device_handle != INVALID_HANDLE_VALUE) {
 		DWORD bytesWritten;
@@ -79,8 +149,15 @@ static int mctp_mmbi_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
 		int retries = 3;
 
 	while (retries--) {
+		OVERLAPPED ov = { 0 };
+
 		// DO NOT hold lock during blocking WriteFile
-		res = WriteFile((HANDLE)mmbi->device_handle, buf, (DWORD)len, &bytesWritten, NULL);
+		/* The device is opened for overlapped reads, so wait for the
+		 * write here */
+		ov.hEvent = mmbi->tx_event;
+		res = WriteFile((HANDLE)mmbi->device_handle, buf, (DWORD)len, NULL, &ov);
+		if (res || GetLastError() == ERROR_IO_PENDING)
+			res = GetOverlappedResult((HANDLE)mmbi->device_handle, &ov, &bytesWritten, TRUE);
 		if (res && bytesWritten == len) break;
 		
 		mctp_prerr("MMBI WriteFile failed, retrying... (%d left)", retries);
@@ -109,6 +186,32 @@ static int mctp_mmbi_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
 	return 0;
 }
 
+/* Memory mode: write the header and payload straight into the TX region,
+ * without staging the packet in binding.tx_storage first */
+static int mctp_mmbi_tx_gather(struct mctp_binding *b,
+			       const struct mctp_hdr *hdr, const void *payload,
+			       size_t len)
+{
+	struct mctp_binding_mmbi *mmbi = container_of(b, struct mctp_binding_mmbi, binding);
+	uint8_t *dst = mmbi->tx_storage;
+
+	if (!dst)
+		return -1;
+
+	mctp_mmbi_tx_activity(mmbi);
+
+	if (sizeof(*hdr) + len > mmbi->memory_size) {
+		mctp_prerr("Packet too large for MMBI: %zu > %zu",
+			   sizeof(*hdr) + len, mmbi->memory_size);
+		return -EMSGSIZE;
+	}
+
+	memcpy(dst, hdr, sizeof(*hdr));
+	memcpy(dst + sizeof(*hdr), payload, len);
+
+	return 0;
+}
+
 // ... start function ...
 
 static int mctp_mmbi_start(struct mctp_binding *b)
@@ -127,6 +230,7 @@ int mctp_mmbi_init_mem(struct mctp_binding_mmbi *mmbi,
 	mmbi->rx_storage = rx_addr;
 	mmbi->memory_size = size;
 	mmbi->binding.tx = mctp_mmbi_tx;
+	mmbi->binding.tx_gather = mctp_mmbi_tx_gather;
 	mmbi->binding.start = mctp_mmbi_start;
 	
 	mmbi->binding.tx_storage = __mctp_alloc(MCTP_PKTBUF_SIZE(65536));
@@ -144,7 +248,7 @@ int mctp_mmbi_init_device(struct mctp_binding_mmbi *mmbi, const char *device_pat
 								0, // No sharing for now? Or FILE_SHARE_READ | FILE_SHARE_WRITE
 								NULL,
 								OPEN_EXISTING,
-								0, // FILE_ATTRIBUTE_NORMAL,
+								FILE_FLAG_OVERLAPPED,
 								NULL);
 	
 	if (hDevice == INVALID_HANDLE_VALUE) {
@@ -168,6 +272,15 @@ int mctp_mmbi_init_device(struct mctp_binding_mmbi *mmbi, const char *device_pat
     if (!mmbi->binding.tx_storage)
         return -ENOMEM;
 
+	// Fixed buffer to support full MTU (64KB) plus header
+	mmbi->rx_buf = __mctp_alloc(MMBI_RX_BUF_SIZE);
+	/* Reads complete on their own event, as ReadFile resets it */
+	mmbi->rx_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+	mmbi->tx_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (!mmbi->rx_buf || !mmbi->rx_event || !mmbi->tx_event)
+		return -ENOMEM;
+	mmbi->rx_ov.hEvent = mmbi->rx_event;
+
 	return 0;
 #else
 	(void)mmbi; (void)device_path;
@@ -175,60 +288,439 @@ int mctp_mmbi_init_device(struct mctp_binding_mmbi *mmbi, const char *device_pat
 #endif
 }
 
-int mctp_mmbi_poll(struct mctp_binding_mmbi *mmbi)
+int mctp_mmbi_set_pipeline(struct mctp_binding_mmbi *mmbi, size_t depth)
+{
+	struct mctp_ring *ring;
+	int rc;
+
+	if (!mmbi)
+		return -EINVAL;
+
+	/* Packets already queued are passed on, rather than lost */
+	if (mmbi->rx_ring && mmbi->binding.bus)
+		mctp_mmbi_process(mmbi);
+	mctp_mmbi_ring_free(mmbi);
+
+	if (!depth)
+		return 0;
+
+	ring = __mctp_alloc(sizeof(*ring));
+	if (!ring)
+		return -ENOMEM;
+
+	rc = mctp_ring_init(ring, depth);
+	if (rc) {
+		__mctp_free(ring);
+		return rc;
+	}
+
+	mmbi->rx_ring = ring;
+	return 0;
+}
+
+/* Pipeline mode: hand a received packet to the protocol thread */
+static int mctp_mmbi_rx_queue(struct mctp_binding_mmbi *mmbi,
+			      struct mctp_pktbuf *pkt)
+{
+	if (!mctp_ring_push(mmbi->rx_ring, pkt)) {
+		mctp_pktbuf_free(pkt);
+		mmbi->rx_dropped++;
+		return -EBUSY;
+	}
+
+	mctp_mmbi_notify(mmbi);
+	return 0;
+}
+
+int mctp_mmbi_process(struct mctp_binding_mmbi *mmbi)
 {
+	struct mctp_pktbuf *pkt;
+	int n = 0;
+
+	if (!mmbi || !mmbi->rx_ring)
+		return -EINVAL;
+
+	while ((pkt = mctp_ring_pop(mmbi->rx_ring))) {
 #ifdef _WIN32
-	if (mmbi->device_handle && mmbi->device_handle != INVALID_HANDLE_VALUE) {
-		// Fixed buffer to support full MTU (64KB) plus header
-		static uint8_t rx_buf[65536 + 10];
-		DWORD bytesRead = 0;
-		DWORD bytesAvail = 0;
+		EnterCriticalSection(&mmbi->lock);
+#endif
+		mctp_bus_rx(&mmbi->binding, pkt);
+#ifdef _WIN32
+		LeaveCriticalSection(&mmbi->lock);
+#endif
+		mctp_pktbuf_free(pkt);
+		n++;
+	}
+
+	return n;
+}
+
+#ifdef _WIN32
+/* Pass a packet read from the device to the core, or the protocol thread */
+static int mctp_mmbi_rx_buf(struct mctp_binding_mmbi *mmbi, const void *buf,
+			    size_t len)
+{
+	struct mctp_pktbuf *pkt;
+
+	pkt = mctp_pktbuf_alloc(&mmbi->binding, len);
+	if (!pkt) {
+		mctp_prerr("MMBI: Failed to allocate pktbuf for %zu bytes", len);
+		return -ENOMEM;
+	}
+	memcpy(mctp_pktbuf_hdr(pkt), buf, len);
+
+	/* The ring is the only state shared with the protocol thread, so no
+	 * lock is needed to queue onto it */
+	if (mmbi->rx_ring)
+		return mctp_mmbi_rx_queue(mmbi, pkt);
+
+#ifdef _WIN32
+	EnterCriticalSection(&mmbi->lock);
+#endif
+	mctp_bus_rx(&mmbi->binding, pkt);
+#ifdef _WIN32
+	LeaveCriticalSection(&mmbi->lock);
+#endif
+	mctp_pktbuf_free(pkt);
+	return 0;
+}
+#endif
+
+#ifdef _WIN32
+/* Keep a read in flight, which signals rx_event when it completes, rather
+ * than peeking and sleeping */
+static int mctp_mmbi_read_start(struct mctp_binding_mmbi *mmbi)
+{
+	HANDLE hDevice = (HANDLE)mmbi->device_handle;
+	DWORD max_to_read;
+	BOOL res;
+
+	if (mmbi->rx_pending)
+		return 0;
 
-		if (!PeekNamedPipe((HANDLE)mmbi->device_handle, NULL, 0, NULL, &bytesAvail, NULL)) {
-			bytesAvail = 1; 
+	// Read exactly one packet at a time to prevent merging in simulation
+	max_to_read = (DWORD)mmbi->binding.pkt_size + 4;
+	if (max_to_read > MMBI_RX_BUF_SIZE) max_to_read = MMBI_RX_BUF_SIZE;
+
+	mmbi->rx_ov.Offset = 0;
+	mmbi->rx_ov.OffsetHigh = 0;
+	res = ReadFile(hDevice, mmbi->rx_buf, max_to_read, NULL, &mmbi->rx_ov);
+	if (!res && GetLastError() != ERROR_IO_PENDING) {
+		DWORD err = GetLastError();
+		if (err == ERROR_BROKEN_PIPE) return -EPIPE;
+		if (err != ERROR_NO_DATA) {
+			mctp_prerr("MMBI ReadFile error: %u", err);
 		}
-		
-		if (bytesAvail == 0) {
-            Sleep(1);
-			return 0;
+		return 0;
+	}
+	/* Also when it completed at once, as rx_event is then set */
+	mmbi->rx_pending = true;
+	return 0;
+}
+
+/* Collect the read in flight if it has completed, and receive its packet.
+ * Returns 1 if a packet was received, 0 if not, or a negative error. */
+static int mctp_mmbi_read_finish(struct mctp_binding_mmbi *mmbi)
+{
+	HANDLE hDevice = (HANDLE)mmbi->device_handle;
+	DWORD bytesRead = 0;
+	BOOL res;
+	int rc;
+
+	if (!mmbi->rx_pending)
+		return 0;
+
+	res = GetOverlappedResult(hDevice, &mmbi->rx_ov, &bytesRead, FALSE);
+	if (!res) {
+		DWORD err = GetLastError();
+		if (err == ERROR_IO_INCOMPLETE) return 0;
+		mmbi->rx_pending = false;
+		if (err == ERROR_BROKEN_PIPE) return -EPIPE;
+		if (err != ERROR_OPERATION_ABORTED) {
+			mctp_prerr("MMBI ReadFile error: %u", err);
 		}
+		return 0;
+	}
 
-		// Read exactly one packet at a time to prevent merging in simulation
-		DWORD max_to_read = (DWORD)mmbi->binding.pkt_size + 4;
-		if (max_to_read > sizeof(rx_buf)) max_to_read = sizeof(rx_buf);
+	mmbi->rx_pending = false;
+	if (!bytesRead)
+		return 0;
+	rc = mctp_mmbi_rx_buf(mmbi, mmbi->rx_buf, bytesRead);
+	return rc < 0 ? rc : 1;
+}
 
-		BOOL res = ReadFile((HANDLE)mmbi->device_handle, rx_buf, max_to_read, &bytesRead, NULL);
-		
-		if (res && bytesRead > 0) {
+/* Collect a finished read, then start the next, so that a wait always
+ * covers one. Returns as mctp_mmbi_read_finish(). */
+static int mctp_mmbi_read_next(struct mctp_binding_mmbi *mmbi)
+{
+	int rc, received;
+
+	received = mctp_mmbi_read_finish(mmbi);
+	if (received < 0)
+		return received;
+
+	rc = mctp_mmbi_read_start(mmbi);
+	return rc < 0 ? rc : received;
+}
+#endif
+
+int mctp_mmbi_poll(struct mctp_binding_mmbi *mmbi)
+{
+#ifdef _WIN32
+	if (mmbi->device_handle && mmbi->device_handle != INVALID_HANDLE_VALUE) {
+		int rc;
+
+		rc = mctp_mmbi_read_start(mmbi);
+		if (rc < 0)
+			return rc;
+
+		rc = mctp_mmbi_read_finish(mmbi);
+		return rc < 0 ? rc : 0;
+	}
+#else
+	(void)mmbi;
+#endif
+	return 0;
+}
+
+mctp_wait_handle_t mctp_mmbi_wait_handle(struct mctp_binding_mmbi *mmbi)
+{
+	return mmbi->wait_handle;
+}
+
+void mctp_mmbi_notify(struct mctp_binding_mmbi *mmbi)
+{
 #ifdef _WIN32
-			EnterCriticalSection(&mmbi->lock);
+	SetEvent(mmbi->wait_handle);
+#else
+	uint64_t one = 1;
+
+	if (mmbi->wait_handle >= 0 &&
+	    write(mmbi->wait_handle, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		mctp_prerr("MMBI notify failed: %d", errno);
 #endif
-			struct mctp_pktbuf *pkt = mctp_pktbuf_alloc(&mmbi->binding, bytesRead);
-			if (!pkt) {
+}
+
+static uint64_t mctp_mmbi_now_us(void)
+{
 #ifdef _WIN32
-				LeaveCriticalSection(&mmbi->lock);
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+	       (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 /
+		       freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 #endif
-				mctp_prerr("MMBI: Failed to allocate pktbuf for %u bytes", bytesRead);
-				return -ENOMEM;
-			}
-			
-            memcpy(mctp_pktbuf_hdr(pkt), rx_buf, bytesRead);
-            mctp_bus_rx(&mmbi->binding, pkt);
+}
+
+static inline void mctp_mmbi_cpu_relax(void)
+{
+#if defined(_WIN32)
+	YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+#ifdef _WIN32
+/* Whether poll_wait reads the device itself. In pipeline mode the I/O
+ * thread owns rx_ov, and a second ReadFile would clash with its read. */
+static bool mctp_mmbi_reads(struct mctp_binding_mmbi *mmbi)
+{
+	return !mmbi->rx_ring && mmbi->rx_event;
+}
+
+/* Number of events to wait on: the notify event, then the read in flight */
+static DWORD mctp_mmbi_events(struct mctp_binding_mmbi *mmbi, HANDLE *events)
+{
+	events[0] = mmbi->wait_handle;
+	events[1] = mmbi->rx_event;
+	return mctp_mmbi_reads(mmbi) && mmbi->rx_pending ? 2 : 1;
+}
+#endif
+
+/* Take a pending signal of the wait handle or device read, without
+ * blocking */
+static bool mctp_mmbi_check(struct mctp_binding_mmbi *mmbi)
+{
+#ifdef _WIN32
+	HANDLE events[2];
+	DWORD n = mctp_mmbi_events(mmbi, events);
+	DWORD rc = WaitForMultipleObjects(n, events, FALSE, 0);
+
+	if (rc == WAIT_OBJECT_0)
+		ResetEvent(mmbi->wait_handle);
+	return rc < WAIT_OBJECT_0 + n;
+#else
+	uint64_t count;
+
+	return read(mmbi->wait_handle, &count, sizeof(count)) ==
+	       sizeof(count);
+#endif
+}
+
+/* Block until the wait handle is signalled or the device read completes.
+ * Returns 1 if woken, 0 on timeout or a negative error. */
+static int mctp_mmbi_block(struct mctp_binding_mmbi *mmbi, int timeout_ms)
+{
 #ifdef _WIN32
-			LeaveCriticalSection(&mmbi->lock);
+	HANDLE events[2];
+	DWORD n = mctp_mmbi_events(mmbi, events);
+	DWORD rc;
+
+	rc = WaitForMultipleObjects(n, events, FALSE,
+				    timeout_ms < 0 ? INFINITE :
+						     (DWORD)timeout_ms);
+	if (rc == WAIT_TIMEOUT)
+		return 0;
+	if (rc == WAIT_FAILED)
+		return -EIO;
+
+	/* A notify after the reset is still seen by the next wait, and the
+	 * read event is left to the poll, which harvests it */
+	if (rc == WAIT_OBJECT_0)
+		ResetEvent(mmbi->wait_handle);
+#else
+	struct pollfd pfd;
+	uint64_t count;
+	int rc;
+
+	pfd.fd = mmbi->wait_handle;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	rc = poll(&pfd, 1, timeout_ms);
+	if (rc < 0)
+		return errno == EINTR ? 0 : -errno;
+	if (rc == 0)
+		return 0;
+
+	if (read(mmbi->wait_handle, &count, sizeof(count)) < 0 &&
+	    errno != EAGAIN)
+		return -errno;
 #endif
-            return 0;
-		} else if (!res) {
-			DWORD err = GetLastError();
-			if (err == ERROR_BROKEN_PIPE) return -EPIPE;
-			if (err != ERROR_IO_PENDING && err != ERROR_NO_DATA) {
-				mctp_prerr("MMBI ReadFile error: %u", err);
+	return 1;
+}
+
+/* Spin until there is work, or until the spin window or @timeout_ms runs
+ * out. The ring needs no system call so is checked on every pause, while
+ * checks of the wait handle back off up to MMBI_SPIN_BACKOFF_MAX pauses. */
+static bool mctp_mmbi_spin(struct mctp_binding_mmbi *mmbi, uint64_t now,
+			   int timeout_ms)
+{
+	uint64_t end = mmbi->last_activity_us + mmbi->spin_us;
+	unsigned int relax = 1, i;
+
+	if (timeout_ms >= 0 && now + (uint64_t)timeout_ms * 1000 < end)
+		end = now + (uint64_t)timeout_ms * 1000;
+
+	do {
+		for (i = 0; i < relax; i++) {
+			if (mmbi->rx_ring && mctp_ring_count(mmbi->rx_ring)) {
+				mctp_mmbi_check(mmbi);
+				return true;
 			}
+			mctp_mmbi_cpu_relax();
+		}
+		if (mctp_mmbi_check(mmbi))
+			return true;
+		if (relax < MMBI_SPIN_BACKOFF_MAX)
+			relax <<= 1;
+	} while (mctp_mmbi_now_us() < end);
+
+	return false;
+}
+
+int mctp_mmbi_poll_wait(struct mctp_binding_mmbi *mmbi, int timeout_ms)
+{
+	struct mctp_mmbi_poll_stats *stats;
+	uint64_t now, waited_ms;
+	int rc;
+
+	if (!mmbi)
+		return -EINVAL;
+
+#ifdef _WIN32
+	/* A read may have finished since the last call. Its packet counts
+	 * as work, and the next read is started for the wait to cover. */
+	if (mctp_mmbi_reads(mmbi)) {
+		rc = mctp_mmbi_read_next(mmbi);
+		if (rc < 0)
+			return rc;
+		if (rc)
+			goto work;
+	}
+#else
+	if (mmbi->wait_handle < 0)
+		return -ENOSYS;
+#endif
+
+	stats = &mmbi->poll_stats;
+	now = mctp_mmbi_now_us();
+	if (mmbi->spin_us && now - mmbi->last_activity_us < mmbi->spin_us) {
+		stats->mode = MCTP_MMBI_POLL_SPIN;
+		stats->spin_waits++;
+		if (mctp_mmbi_spin(mmbi, now, timeout_ms)) {
+			stats->spin_hits++;
+			goto work;
+		}
+
+		/* Block for whatever is left of the timeout */
+		if (timeout_ms >= 0) {
+			waited_ms = (mctp_mmbi_now_us() - now) / 1000;
+			if (waited_ms >= (uint64_t)timeout_ms)
+				return 0;
+			timeout_ms -= (int)waited_ms;
 		}
-		return 0; 
+	}
+
+	stats->mode = MCTP_MMBI_POLL_BLOCK;
+	stats->blocks++;
+	rc = mctp_mmbi_block(mmbi, timeout_ms);
+	if (rc <= 0)
+		return rc;
+	stats->block_wakes++;
+
+work:
+	mmbi->last_activity_us = mctp_mmbi_now_us();
+
+#ifdef _WIN32
+	if (mctp_mmbi_reads(mmbi)) {
+		rc = mctp_mmbi_read_next(mmbi);
+		if (rc < 0)
+			return rc;
 	}
 #endif
-	return 0;
+
+	if (mmbi->rx_ring)
+		mctp_mmbi_process(mmbi);
+
+	/* The wake may be reporting TX room */
+	if (mmbi->binding.bus)
+		mctp_binding_set_tx_enabled(&mmbi->binding, true);
+
+	return 1;
+}
+
+void mctp_mmbi_set_poll_policy(struct mctp_binding_mmbi *mmbi,
+			       uint32_t spin_us)
+{
+	mmbi->spin_us = spin_us;
+}
+
+void mctp_mmbi_get_poll_stats(struct mctp_binding_mmbi *mmbi,
+			      struct mctp_mmbi_poll_stats *stats)
+{
+	*stats = mmbi->poll_stats;
 }
 
 int mctp_mmbi_rx(struct mctp_binding_mmbi *mmbi, size_t len)
@@ -243,7 +735,7 @@ int mctp_mmbi_rx(struct mctp_binding_mmbi *mmbi, size_t len)
 	if (len > mmbi->memory_size)
 		return -EMSGSIZE;
 
-	pkt = mctp_pktbuf_alloc(&mmbi->binding, len);
+	pkt = mctp_pktbuf_alloc(&mmbi->binding, 0);
 	if (!pkt)
 		return -ENOMEM;
 
@@ -252,7 +744,11 @@ int mctp_mmbi_rx(struct mctp_binding_mmbi *mmbi, size_t len)
 		return -1;
 	}
 
+	if (mmbi->rx_ring)
+		return mctp_mmbi_rx_queue(mmbi, pkt);
+
 	mctp_bus_rx(&mmbi->binding, pkt);
+	mctp_pktbuf_free(pkt);
 
 	return 0;
 }
@@ -384,3 +880,29 @@ int mctp_mmbi_context_poll(mctp_mmbi_context_t *ctx)
 	// MMBI_DBG(ctx, "Poll..."); // Too noisy for poll
 	return mctp_mmbi_poll(ctx->mmbi);
 }
+
+int mctp_mmbi_context_set_pipeline(mctp_mmbi_context_t *ctx, size_t depth)
+{
+	if (!ctx || !ctx->mmbi) return -1;
+	return mctp_mmbi_set_pipeline(ctx->mmbi, depth);
+}
+
+int mctp_mmbi_context_process(mctp_mmbi_context_t *ctx)
+{
+	if (!ctx || !ctx->mmbi) return -1;
+	return mctp_mmbi_process(ctx->mmbi);
+}
+
+int mctp_mmbi_context_poll_wait(mctp_mmbi_context_t *ctx, int timeout_ms)
+{
+	if (!ctx || !ctx->mmbi) return -1;
+	return mctp_mmbi_poll_wait(ctx->mmbi, timeout_ms);
+}
+
+int mctp_mmbi_context_set_poll_policy(mctp_mmbi_context_t *ctx,
+				      uint32_t spin_us)
+{
+	if (!ctx || !ctx->mmbi) return -1;
+	mctp_mmbi_set_poll_policy(ctx->mmbi, spin_us);
+	return 0;
+}
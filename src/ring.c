@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: Apache-2.0 OR GPL-2.0-or-later */
+
+#include <errno.h>
+#include <string.h>
+
+#include "libmctp.h"
+#include "libmctp-alloc.h"
+#include "ring.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#include <intrin.h>
+#endif
+
+/*
+ * The producer publishes a slot with a release store of tail, after
+ * filling it, and the consumer frees one with a release store of head,
+ * after reading it. Each side reads the other's index with an acquire
+ * load.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+static inline size_t mctp_ring_load(const size_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void mctp_ring_store(size_t *p, size_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+#elif defined(_MSC_VER)
+/* Plain loads and stores are ordered on x86, so only the compiler needs
+ * holding back there */
+static inline size_t mctp_ring_load(const size_t *p)
+{
+	size_t v = *(const volatile size_t *)p;
+#if defined(_M_IX86) || defined(_M_X64)
+	_ReadWriteBarrier();
+#else
+	MemoryBarrier();
+#endif
+	return v;
+}
+
+static inline void mctp_ring_store(size_t *p, size_t v)
+{
+#if defined(_M_IX86) || defined(_M_X64)
+	_ReadWriteBarrier();
+#else
+	MemoryBarrier();
+#endif
+	*(volatile size_t *)p = v;
+}
+#else
+#error No atomic operations for this compiler
+#endif
+
+int mctp_ring_init(struct mctp_ring *ring, size_t size)
+{
+	size_t n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->slots = __mctp_alloc(n * sizeof(*ring->slots));
+	if (!ring->slots)
+		return -ENOMEM;
+
+	ring->mask = n - 1;
+	return 0;
+}
+
+void mctp_ring_destroy(struct mctp_ring *ring)
+{
+	__mctp_free(ring->slots);
+	ring->slots = NULL;
+}
+
+bool mctp_ring_push(struct mctp_ring *ring, void *item)
+{
+	size_t tail = ring->tail;
+
+	if (tail - mctp_ring_load(&ring->head) > ring->mask)
+		return false;
+
+	ring->slots[tail & ring->mask] = item;
+	mctp_ring_store(&ring->tail, tail + 1);
+	return true;
+}
+
+void *mctp_ring_pop(struct mctp_ring *ring)
+{
+	size_t head = ring->head;
+	void *item;
+
+	if (head == mctp_ring_load(&ring->tail))
+		return NULL;
+
+	item = ring->slots[head & ring->mask];
+	mctp_ring_store(&ring->head, head + 1);
+	return item;
+}
+
+size_t mctp_ring_count(struct mctp_ring *ring)
+{
+	return mctp_ring_load(&ring->tail) - mctp_ring_load(&ring->head);
+}
@@ -0,0 +1,288 @@
+/* SPDX-License-Identifier: Apache-2.0 OR GPL-2.0-or-later */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "libmctp-shard.h"
+#include "libmctp-alloc.h"
+#include "libmctp-log.h"
+#include "container_of.h"
+#include "core-internal.h"
+#include "ring.h"
+
+#define BINDING_NAME "shard"
+
+struct mctp_shard {
+	/* Registered with mctp, and transmits through the lower binding */
+	struct mctp_binding binding;
+	struct mctp *mctp;
+	struct mctp_shard_set *set;
+	unsigned int index;
+	/* Received packets, from the I/O thread to the worker */
+	struct mctp_ring rx_ring;
+	struct mctp_shard_stats stats;
+};
+
+struct mctp_shard_set {
+	struct mctp_binding *lower;
+#if MCTP_THREAD_SAFE
+	/* Serialises the shards' calls to lower->tx */
+	struct mctp_lock tx_lock;
+	/* Covers eid */
+	struct mctp_lock eid_lock;
+#endif
+	/* Local EID of every shard. A Set Endpoint ID handled by one shard
+	 * is published here and picked up by the others. */
+	mctp_eid_t eid;
+	unsigned int n;
+	struct mctp_shard *shards[MCTP_SHARDS_MAX];
+};
+
+static int mctp_shard_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
+{
+	struct mctp_shard *shard =
+		container_of(b, struct mctp_shard, binding);
+	struct mctp_shard_set *set = shard->set;
+	int rc;
+
+	mctp_lock(&set->tx_lock);
+	rc = set->lower->tx(set->lower, pkt);
+	mctp_unlock(&set->tx_lock);
+
+	return rc;
+}
+
+/* Keep the tags of requests from a shard to those that steer back to it */
+static bool mctp_shard_tag_filter(mctp_eid_t eid, uint8_t tag, void *data)
+{
+	struct mctp_shard *shard = data;
+
+	return mctp_shard_index(shard->set, eid, tag) == shard->index;
+}
+
+static void mctp_shard_free(struct mctp_shard *shard)
+{
+	struct mctp_pktbuf *pkt;
+
+	if (shard->mctp) {
+		if (shard->binding.bus)
+			mctp_unregister_bus(shard->mctp, &shard->binding);
+		mctp_destroy(shard->mctp);
+	}
+
+	if (shard->rx_ring.slots) {
+		while ((pkt = mctp_ring_pop(&shard->rx_ring)))
+			mctp_pktbuf_free(pkt);
+		mctp_ring_destroy(&shard->rx_ring);
+	}
+
+	__mctp_free(shard->binding.tx_storage);
+	__mctp_free(shard);
+}
+
+static struct mctp_shard *mctp_shard_create(struct mctp_shard_set *set,
+					    unsigned int index,
+					    mctp_eid_t eid, size_t depth)
+{
+	struct mctp_binding *lower = set->lower;
+	struct mctp_shard *shard;
+
+	shard = __mctp_alloc(sizeof(*shard));
+	if (!shard)
+		return NULL;
+
+	memset(shard, 0, sizeof(*shard));
+	shard->set = set;
+	shard->index = index;
+	shard->binding.name = BINDING_NAME;
+	shard->binding.version = 1;
+	shard->binding.pkt_size = lower->pkt_size;
+	shard->binding.pkt_header = lower->pkt_header;
+	shard->binding.pkt_trailer = lower->pkt_trailer;
+	shard->binding.tx = mctp_shard_tx;
+	shard->binding.tx_storage = __mctp_alloc(MCTP_PKTBUF_SIZE(
+		lower->pkt_size + lower->pkt_header + lower->pkt_trailer));
+	if (!shard->binding.tx_storage)
+		goto err;
+
+	if (mctp_ring_init(&shard->rx_ring, depth))
+		goto err;
+
+	shard->mctp = mctp_init();
+	if (!shard->mctp)
+		goto err;
+
+	mctp_set_tag_filter(shard->mctp, mctp_shard_tag_filter, shard);
+	if (mctp_register_bus(shard->mctp, &shard->binding, eid))
+		goto err;
+	mctp_binding_set_tx_enabled(&shard->binding, true);
+
+	return shard;
+
+err:
+	mctp_shard_free(shard);
+	return NULL;
+}
+
+struct mctp_shard_set *mctp_shard_init(struct mctp_binding *lower,
+				       mctp_eid_t eid, unsigned int n,
+				       size_t depth)
+{
+	struct mctp_shard_set *set;
+	unsigned int i;
+
+	if (!lower || !lower->tx || !n || n > MCTP_SHARDS_MAX || !depth)
+		return NULL;
+
+#if !MCTP_THREAD_SAFE
+	mctp_prerr("Shards need a build with MCTP_THREAD_SAFE");
+	return NULL;
+#endif
+
+	set = __mctp_alloc(sizeof(*set));
+	if (!set)
+		return NULL;
+
+	memset(set, 0, sizeof(*set));
+	set->lower = lower;
+	set->eid = eid;
+	set->n = n;
+	mctp_lock_init(&set->tx_lock);
+	mctp_lock_init(&set->eid_lock);
+
+	for (i = 0; i < n; i++) {
+		set->shards[i] = mctp_shard_create(set, i, eid, depth);
+		if (!set->shards[i]) {
+			mctp_prerr("Failed to create shard %u", i);
+			mctp_shard_destroy(set);
+			return NULL;
+		}
+	}
+
+	return set;
+}
+
+void mctp_shard_destroy(struct mctp_shard_set *set)
+{
+	unsigned int i;
+
+	if (!set)
+		return;
+
+	for (i = 0; i < set->n; i++) {
+		if (set->shards[i])
+			mctp_shard_free(set->shards[i]);
+	}
+
+	mctp_lock_destroy(&set->eid_lock);
+	mctp_lock_destroy(&set->tx_lock);
+	__mctp_free(set);
+}
+
+unsigned int mctp_shard_count(struct mctp_shard_set *set)
+{
+	return set->n;
+}
+
+struct mctp *mctp_shard_mctp(struct mctp_shard_set *set, unsigned int i)
+{
+	return i < set->n ? set->shards[i]->mctp : NULL;
+}
+
+unsigned int mctp_shard_index(struct mctp_shard_set *set, mctp_eid_t eid,
+			      uint8_t tag)
+{
+	return (eid + (tag & MCTP_HDR_TAG_MASK)) % set->n;
+}
+
+int mctp_shard_rx(struct mctp_shard_set *set, struct mctp_pktbuf *pkt)
+{
+	size_t len = mctp_pktbuf_size(pkt);
+	struct mctp_shard *shard;
+	struct mctp_pktbuf *copy;
+	struct mctp_hdr *hdr;
+
+	if (len < sizeof(*hdr))
+		return -EINVAL;
+
+	hdr = mctp_pktbuf_hdr(pkt);
+	shard = set->shards[mctp_shard_index(
+		set, hdr->src, hdr->flags_seq_tag >> MCTP_HDR_TAG_SHIFT)];
+
+	copy = mctp_pktbuf_alloc(&shard->binding, len);
+	if (!copy)
+		return -ENOMEM;
+	memcpy(mctp_pktbuf_hdr(copy), hdr, len);
+
+	if (!mctp_ring_push(&shard->rx_ring, copy)) {
+		mctp_pktbuf_free(copy);
+		shard->stats.dropped++;
+		return -EBUSY;
+	}
+
+	shard->stats.rx++;
+	return 0;
+}
+
+int mctp_shard_process(struct mctp_shard_set *set, unsigned int i)
+{
+	struct mctp_shard *shard;
+	struct mctp_pktbuf *pkt;
+	mctp_eid_t eid;
+	int n = 0;
+
+	if (i >= set->n)
+		return -EINVAL;
+
+	shard = set->shards[i];
+
+	/* Take up an EID set through another shard */
+	mctp_lock(&set->eid_lock);
+	eid = set->eid;
+	mctp_unlock(&set->eid_lock);
+	if (shard->binding.bus->eid != eid)
+		mctp_bus_set_eid(&shard->binding, eid);
+
+	while ((pkt = mctp_ring_pop(&shard->rx_ring))) {
+		mctp_bus_rx(&shard->binding, pkt);
+		mctp_pktbuf_free(pkt);
+		n++;
+	}
+
+	/* A Set Endpoint ID handled here applies to every shard */
+	if (shard->binding.bus->eid != eid) {
+		mctp_lock(&set->eid_lock);
+		set->eid = shard->binding.bus->eid;
+		mctp_unlock(&set->eid_lock);
+	}
+
+	return n;
+}
+
+int mctp_shard_message_tx(struct mctp_shard_set *set, mctp_eid_t eid,
+			  bool tag_owner, uint8_t msg_tag, const void *msg,
+			  size_t msg_len)
+{
+	unsigned int i = mctp_shard_index(set, eid, msg_tag);
+
+	return mctp_message_tx(set->shards[i]->mctp, eid, tag_owner, msg_tag,
+			       msg, msg_len);
+}
+
+void mctp_shard_tx_ready(struct mctp_shard_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->n; i++)
+		mctp_binding_set_tx_enabled(&set->shards[i]->binding, true);
+}
+
+void mctp_shard_get_stats(struct mctp_shard_set *set, unsigned int i,
+			  struct mctp_shard_stats *stats)
+{
+	if (i < set->n)
+		*stats = set->shards[i]->stats;
+	else
+		memset(stats, 0, sizeof(*stats));
+}
@@ -1,6 +1,7 @@
 
 #define _GNU_SOURCE
 
+#include "compiler.h"
 #include "mctp_transport.h"
 #include "libmctp.h"
 #include "libmctp-mmbi.h"
@@ -16,8 +17,9 @@ struct mctp_transport {
 };
 
 /* Internal libmctp callback */
-static void transport_rx_handler(uint8_t eid, bool tag_owner, uint8_t msg_tag,
-                                 void *data, void *msg, size_t len)
+static void transport_rx_handler(uint8_t eid, bool tag_owner __unused,
+                                 uint8_t msg_tag __unused, void *data,
+                                 void *msg, size_t len)
 {
     struct mctp_transport *ctx = (struct mctp_transport *)data;
     if (ctx && ctx->rx_cb) {
@@ -104,3 +106,15 @@ int mctp_transport_poll(mctp_transport_t *ctx)
     
     return mctp_mmbi_poll(ctx->mmbi);
 }
+
+int mctp_transport_poll_wait(mctp_transport_t *ctx, int timeout_ms)
+{
+    if (!ctx || !ctx->mmbi) return -1;
+
+    return mctp_mmbi_poll_wait(ctx->mmbi, timeout_ms);
+}
+
+mctp_wait_handle_t mctp_transport_get_wait_handle(mctp_transport_t *ctx)
+{
+    return mctp_mmbi_wait_handle(ctx->mmbi);
+}
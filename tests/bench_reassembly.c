@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: Apache-2.0 OR GPL-2.0-or-later */
+
+/*
+ * Reassembly memory benchmark.
+ *
+ * Feeds a mix of small two-packet messages and occasional large messages
+ * through mctp_bus_rx(), with many reassembly contexts open at once, and
+ * reports allocator traffic, peak bytes held by the allocator and the peak
+ * process RSS.
+ *
+ * Usage: bench_reassembly [grow|prealloc|chain]
+ *   grow     - reassembly buffers start small and grow (default)
+ *   prealloc - reassembly buffers are allocated at max_message_size
+ *   chain    - messages are kept as fragment chains (mctp_set_rx_iov())
+ *
+ * Peak RSS is a process-wide high water mark, so run each mode in its own
+ * process when comparing it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "compiler.h"
+#include "libmctp.h"
+#include "range.h"
+
+#define BENCH_LOCAL_EID	  8
+#define BENCH_MTU	  4096
+#define BENCH_PEERS	  16
+#define BENCH_ROUNDS	  256
+#define BENCH_LARGE_EVERY 32
+#define BENCH_LARGE_SIZE  (1024 * 1024)
+
+struct bench_stats {
+	size_t allocs;
+	size_t msg_allocs;
+	size_t cur_bytes;
+	size_t peak_bytes;
+	size_t messages;
+	size_t message_bytes;
+};
+
+static struct bench_stats stats;
+
+/* Allocations carry a size header so that frees can be accounted */
+struct bench_hdr {
+	size_t size;
+	size_t pad;
+};
+
+static void *bench_alloc(size_t size)
+{
+	struct bench_hdr *hdr = malloc(sizeof(*hdr) + size);
+
+	if (!hdr)
+		return NULL;
+
+	hdr->size = size;
+	stats.allocs++;
+	stats.cur_bytes += size;
+	if (stats.cur_bytes > stats.peak_bytes)
+		stats.peak_bytes = stats.cur_bytes;
+
+	return hdr + 1;
+}
+
+static void bench_free(void *ptr)
+{
+	struct bench_hdr *hdr;
+
+	if (!ptr)
+		return;
+
+	hdr = (struct bench_hdr *)ptr - 1;
+	stats.cur_bytes -= hdr->size;
+	free(hdr);
+}
+
+static void *bench_msg_alloc(size_t size, void *ctx __unused)
+{
+	stats.msg_allocs++;
+	return bench_alloc(size);
+}
+
+static void bench_msg_free(void *msg, void *ctx __unused)
+{
+	bench_free(msg);
+}
+
+static size_t bench_peak_rss_kb(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+	return usage.ru_maxrss;
+#endif
+}
+
+static void bench_rx(uint8_t eid __unused, bool tag_owner __unused,
+		     uint8_t msg_tag __unused, void *data __unused, void *msg,
+		     size_t len)
+{
+	(void)msg;
+	stats.messages++;
+	stats.message_bytes += len;
+}
+
+static void bench_rx_iov(uint8_t eid __unused, bool tag_owner __unused,
+			 uint8_t msg_tag __unused, void *data __unused,
+			 const struct mctp_iovec *iov __unused,
+			 size_t iovcnt __unused, size_t len)
+{
+	stats.messages++;
+	stats.message_bytes += len;
+}
+
+static int bench_tx(struct mctp_binding *b __unused,
+		    struct mctp_pktbuf *pkt __unused)
+{
+	return 0;
+}
+
+static void bench_rx_packet(struct mctp_binding *binding,
+			    struct mctp_pktbuf *pkt, mctp_eid_t src,
+			    uint8_t flags, uint8_t seq, size_t len)
+{
+	struct mctp_hdr *hdr;
+
+	pkt = mctp_pktbuf_init(binding, pkt);
+	hdr = mctp_pktbuf_hdr(pkt);
+	hdr->ver = 1;
+	hdr->dest = BENCH_LOCAL_EID;
+	hdr->src = src;
+	hdr->flags_seq_tag = flags | MCTP_HDR_FLAG_TO |
+			     ((seq & MCTP_HDR_SEQ_MASK) << MCTP_HDR_SEQ_SHIFT);
+	pkt->end = pkt->start + sizeof(*hdr) + len;
+
+	mctp_bus_rx(binding, pkt);
+}
+
+/* Send a message of @len bytes from @src as a sequence of MTU packets */
+static void bench_rx_message(struct mctp_binding *binding,
+			     struct mctp_pktbuf *pkt, mctp_eid_t src,
+			     size_t len)
+{
+	size_t pos = 0;
+	uint8_t seq = 0;
+
+	while (pos < len) {
+		size_t frag = MIN((size_t)BENCH_MTU, len - pos);
+		uint8_t flags = 0;
+
+		if (pos == 0)
+			flags |= MCTP_HDR_FLAG_SOM;
+		if (pos + frag >= len)
+			flags |= MCTP_HDR_FLAG_EOM;
+
+		bench_rx_packet(binding, pkt, src, flags, seq++, frag);
+		pos += frag;
+	}
+}
+
+static int bench_run(const char *mode)
+{
+	PKTBUF_STORAGE_ALIGN_DECL static uint8_t tx_storage
+		[MCTP_PKTBUF_SIZE(BENCH_MTU)] PKTBUF_STORAGE_ALIGN;
+	PKTBUF_STORAGE_ALIGN_DECL static uint8_t rx_storage
+		[MCTP_PKTBUF_SIZE(BENCH_MTU)] PKTBUF_STORAGE_ALIGN;
+	struct mctp_pktbuf *pkt = (struct mctp_pktbuf *)rx_storage;
+	struct mctp_binding binding;
+	struct mctp *mctp;
+	int round, peer;
+
+	mctp = mctp_init();
+	if (!mctp)
+		return -1;
+
+	if (!strcmp(mode, "prealloc")) {
+		mctp_set_reassembly_initial_size(mctp, SIZE_MAX);
+	} else if (!strcmp(mode, "chain")) {
+		mctp_set_rx_iov(mctp, bench_rx_iov, NULL);
+	} else if (strcmp(mode, "grow")) {
+		fprintf(stderr, "unknown mode '%s'\n", mode);
+		mctp_destroy(mctp);
+		return -1;
+	}
+
+	memset(&binding, 0, sizeof(binding));
+	binding.name = "bench";
+	binding.version = 1;
+	binding.tx = bench_tx;
+	binding.pkt_size = MCTP_PACKET_SIZE(BENCH_MTU);
+	binding.tx_storage = tx_storage;
+
+	mctp_register_bus(mctp, &binding, BENCH_LOCAL_EID);
+	mctp_binding_set_tx_enabled(&binding, true);
+	mctp_set_rx_all(mctp, bench_rx, NULL);
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		/* Open a context per peer, then complete them all, so that
+		 * BENCH_PEERS small messages are in reassembly at once */
+		for (peer = 0; peer < BENCH_PEERS; peer++)
+			bench_rx_packet(&binding, pkt, 10 + peer,
+					MCTP_HDR_FLAG_SOM, 0, BENCH_MTU);
+		for (peer = 0; peer < BENCH_PEERS; peer++)
+			bench_rx_packet(&binding, pkt, 10 + peer,
+					MCTP_HDR_FLAG_EOM, 1, 16);
+
+		if (round % BENCH_LARGE_EVERY == 0)
+			bench_rx_message(&binding, pkt, 100,
+					 BENCH_LARGE_SIZE);
+	}
+
+	mctp_unregister_bus(mctp, &binding);
+	mctp_destroy(mctp);
+
+	printf("%-9s messages %zu (%zu bytes), allocs %zu (msg %zu), "
+	       "peak alloc %zu KiB, peak RSS %zu KiB\n",
+	       mode, stats.messages, stats.message_bytes, stats.allocs,
+	       stats.msg_allocs, stats.peak_bytes / 1024,
+	       bench_peak_rss_kb());
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *mode = argc > 1 ? argv[1] : "grow";
+
+	mctp_set_alloc_ops(bench_alloc, bench_free, bench_msg_alloc,
+			   bench_msg_free);
+
+	return bench_run(mode) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -44,8 +44,7 @@ int main(int argc, char *argv[]) {
     // 3. Poll Loop
     printf("[BMC] Listening... (Ctrl+C to stop)\n");
     while (1) {
-        mctp_mmbi_context_poll(ctx);
-        Sleep(10);
+        mctp_mmbi_context_poll_wait(ctx, -1);
     }
     
     mctp_mmbi_context_destroy(ctx);
@@ -46,8 +46,7 @@ int main(int argc, char *argv[]) {
     // 4. Poll Loop
     printf("[HOST] Polling for response (Ctrl+C to stop)...\n");
     while (1) {
-        mctp_mmbi_context_poll(ctx);
-        Sleep(10);
+        mctp_mmbi_context_poll_wait(ctx, -1);
     }
     
     mctp_mmbi_context_destroy(ctx);
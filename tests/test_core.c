@@ -16,6 +16,10 @@
 #endif
 #include <stdbool.h>
 #include <stdint.h>
+#if MCTP_THREAD_SAFE && !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +27,7 @@
 
 #include "compiler.h"
 #include "libmctp-alloc.h"
+#include "libmctp-cmds.h"
 #include "libmctp-log.h"
 #include "range.h"
 #include "test-utils.h"
@@ -63,6 +68,31 @@ static void rx_message(uint8_t eid __unused, bool tag_owner, uint8_t msg_tag,
 	param->tag_owner = tag_owner;
 }
 
+struct test_rx_data {
+	bool seen;
+	size_t len;
+	uint8_t buf[MAX_PAYLOAD_SIZE];
+};
+
+static void rx_message_data(uint8_t eid __unused, bool tag_owner __unused,
+			    uint8_t msg_tag __unused, void *data, void *msg,
+			    size_t len)
+{
+	struct test_rx_data *rx = data;
+
+	assert(len <= sizeof(rx->buf));
+	rx->seen = true;
+	rx->len = len;
+	memcpy(rx->buf, msg, len);
+}
+
+static uint64_t test_now_ms;
+
+static uint64_t test_now(void *ctx __unused)
+{
+	return test_now_ms;
+}
+
 static uint8_t get_sequence()
 {
 	static uint8_t pkt_seq = 0;
@@ -620,6 +650,7 @@ static void mctp_core_test_tx_alloc_tag()
 	size_t msg_len = 10;
 
 	mctp_test_stack_init(&mctp, &binding, dest_eid1);
+	mctp_set_now_op(mctp, test_now, NULL);
 	mctp_set_rx_all(mctp, rx_message, &test_param);
 
 	uint8_t used = 0;
@@ -674,25 +705,2131 @@ static void mctp_core_test_tx_alloc_tag()
 	mctp_destroy(mctp);
 }
 
-/* clang-format off */
-#define TEST_CASE(test) { #test, test }
-static const struct {
-	const char *name;
-	void (*test)(void);
-} mctp_core_tests[] = {
-	TEST_CASE(mctp_core_test_simple_rx),
-	TEST_CASE(mctp_core_test_receive_equal_length_fragments),
-	TEST_CASE(mctp_core_test_receive_unexpected_smaller_middle_fragment),
-	TEST_CASE(mctp_core_test_receive_unexpected_bigger_middle_fragment),
-	TEST_CASE(mctp_core_test_receive_smaller_end_fragment),
-	TEST_CASE(mctp_core_test_receive_bigger_end_fragment),
-	TEST_CASE(mctp_core_test_drop_large_fragments),
-	TEST_CASE(mctp_core_test_exhaust_context_buffers),
-	TEST_CASE(mctp_core_test_rx_with_tag),
-	TEST_CASE(mctp_core_test_rx_with_tag_multifragment),
-	TEST_CASE(mctp_core_test_rx_with_null_dst_eid),
-	TEST_CASE(mctp_core_test_rx_with_broadcast_dst_eid),
-	TEST_CASE(mctp_core_test_tx_alloc_tag),
+static int test_tx_request(struct mctp *mctp, mctp_eid_t eid, uint8_t *tag)
+{
+	void *msg = __mctp_alloc(10);
+
+	memset(msg, 0x99, 10);
+	return mctp_message_tx_request(mctp, eid, msg, 10, tag);
+}
+
+/*
+ * Each peer has its own eight tags. Tags expire MCTP_TAG_TIMEOUT after
+ * allocation, and the shared pool of tag entries is freed by responses.
+ */
+static void mctp_core_test_tx_tag_expiry()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_params test_param;
+	uint8_t tag, replied_tag = 0;
+	mctp_eid_t eid, last_eid = 0;
+	uint8_t payload[10];
+	struct pktbuf pktbuf;
+	int i, rc;
+
+	mctp_test_stack_init(&mctp, &binding, 30);
+	mctp_set_now_op(mctp, test_now, NULL);
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+	test_now_ms = 1000;
+
+	for (i = 0; i < 8; i++)
+		assert(test_tx_request(mctp, 30, &tag) == 0);
+	assert(test_tx_request(mctp, 30, &tag) == -EBUSY);
+	assert(test_tx_request(mctp, 31, &tag) == 0);
+
+	/* Still held at the timeout, free just after */
+	test_now_ms += 6000;
+	assert(test_tx_request(mctp, 30, &tag) == -EBUSY);
+	test_now_ms += 1;
+	assert(test_tx_request(mctp, 30, &tag) == 0);
+
+	/* Exhaust the pool across peers */
+	for (eid = 40, rc = 0; rc == 0; eid++) {
+		rc = test_tx_request(mctp, eid, &tag);
+		if (rc == 0) {
+			last_eid = eid;
+			replied_tag = tag;
+		}
+	}
+	assert(rc == -EBUSY && last_eid > 40);
+	assert(test_tx_request(mctp, eid, &tag) == -EBUSY);
+
+	/* A response releases its entry */
+	memset(payload, 0x99, sizeof(payload));
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.ver = 1;
+	pktbuf.hdr.dest = 30;
+	pktbuf.hdr.src = last_eid;
+	receive_one_fragment(binding, payload, sizeof(payload),
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM |
+				     replied_tag,
+			     &pktbuf);
+	assert(test_tx_request(mctp, eid, &tag) == 0);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+/*
+ * Reassembly buffers start small and grow as fragments arrive. Check that
+ * the message survives several grow steps intact.
+ */
+static void mctp_core_test_reassembly_grow()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	static struct test_rx_data rx;
+	static uint8_t test_payload[16 * MCTP_BTU];
+	uint8_t tag = MCTP_HDR_FLAG_TO | get_tag();
+	const int n_frags = 16;
+	struct pktbuf pktbuf;
+	uint8_t flags_seq_tag;
+	size_t i;
+
+	for (i = 0; i < sizeof(test_payload); i++)
+		test_payload[i] = i & 0xff;
+	memset(&rx, 0, sizeof(rx));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_reassembly_initial_size(mctp, MCTP_BTU / 2);
+	mctp_set_rx_all(mctp, rx_message_data, &rx);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	for (i = 0; i < (size_t)n_frags; i++) {
+		flags_seq_tag = (get_sequence() << MCTP_HDR_SEQ_SHIFT) | tag;
+		if (i == 0)
+			flags_seq_tag |= MCTP_HDR_FLAG_SOM;
+		if (i == (size_t)n_frags - 1)
+			flags_seq_tag |= MCTP_HDR_FLAG_EOM;
+		receive_one_fragment(binding, test_payload + i * MCTP_BTU,
+				     MCTP_BTU, flags_seq_tag, &pktbuf);
+	}
+
+	assert(rx.seen);
+	assert(rx.len == sizeof(test_payload));
+	assert(memcmp(rx.buf, test_payload, sizeof(test_payload)) == 0);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+/*
+ * max_message_size remains the ceiling for a growing reassembly buffer.
+ */
+static void mctp_core_test_reassembly_max_size()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_params test_param;
+	static uint8_t test_payload[4 * MCTP_BTU];
+	uint8_t tag = MCTP_HDR_FLAG_TO | get_tag();
+	struct pktbuf pktbuf;
+	uint8_t flags_seq_tag;
+	int i;
+
+	memset(test_payload, 0, sizeof(test_payload));
+	test_param.seen = false;
+	test_param.message_size = 0;
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_max_message_size(mctp, 3 * MCTP_BTU);
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	for (i = 0; i < 4; i++) {
+		flags_seq_tag = (get_sequence() << MCTP_HDR_SEQ_SHIFT) | tag;
+		if (i == 0)
+			flags_seq_tag |= MCTP_HDR_FLAG_SOM;
+		if (i == 3)
+			flags_seq_tag |= MCTP_HDR_FLAG_EOM;
+		receive_one_fragment(binding, test_payload + i * MCTP_BTU,
+				     MCTP_BTU, flags_seq_tag, &pktbuf);
+	}
+
+	assert(!test_param.seen);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+struct test_interleave {
+	int count;
+	bool ok;
+};
+
+static void rx_message_interleave(uint8_t eid, bool tag_owner __unused,
+				  uint8_t msg_tag, void *data, void *msg,
+				  size_t len)
+{
+	struct test_interleave *t = data;
+	uint8_t *buf = msg;
+	size_t i;
+
+	t->count++;
+	/* Each payload byte encodes the (src, tag) it was sent with */
+	for (i = 0; i < len; i++) {
+		if (buf[i] != (uint8_t)(eid << 3 | msg_tag))
+			t->ok = false;
+	}
+}
+
+/*
+ * Fill every reassembly context with interleaved messages from different
+ * (src, tag) flows, completing them out of order, to exercise the context
+ * index. Run it twice so that freed index entries are reused.
+ */
+static void mctp_core_test_reassembly_interleaved()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_interleave t = { 0, true };
+	uint8_t test_payload[MCTP_BTU];
+	const int n_flows = 16;
+	struct pktbuf pktbuf;
+	int round, frag, i;
+
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_rx_all(mctp, rx_message_interleave, &t);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+
+	for (round = 0; round < 2; round++) {
+		for (frag = 0; frag < 3; frag++) {
+			for (i = 0; i < n_flows; i++) {
+				/* Middle fragments in reverse order */
+				int flow = frag == 1 ? n_flows - 1 - i : i;
+				uint8_t src = TEST_SRC_EID + flow % 4;
+				uint8_t tag = flow / 4;
+				uint8_t flags_seq_tag =
+					(frag << MCTP_HDR_SEQ_SHIFT) |
+					MCTP_HDR_FLAG_TO | tag;
+
+				if (frag == 0)
+					flags_seq_tag |= MCTP_HDR_FLAG_SOM;
+				if (frag == 2)
+					flags_seq_tag |= MCTP_HDR_FLAG_EOM;
+
+				memset(test_payload, src << 3 | tag,
+				       sizeof(test_payload));
+				pktbuf.hdr.src = src;
+				receive_one_fragment(binding, test_payload,
+						     MCTP_BTU, flags_seq_tag,
+						     &pktbuf);
+			}
+		}
+		assert(t.count == (round + 1) * n_flows);
+	}
+	assert(t.ok);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+static size_t test_msg_allocs;
+
+static void *test_msg_alloc(size_t size, void *ctx __unused)
+{
+	test_msg_allocs++;
+	return malloc(size);
+}
+
+static void test_msg_free(void *msg, void *ctx __unused)
+{
+	free(msg);
+}
+
+/*
+ * Single-packet messages are delivered in place, without any message
+ * allocation.
+ */
+static void mctp_core_test_rx_single_packet_no_alloc()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	static struct test_rx_data rx;
+	uint8_t test_payload[MCTP_BTU];
+	struct pktbuf pktbuf;
+	size_t i;
+
+	for (i = 0; i < sizeof(test_payload); i++)
+		test_payload[i] = i;
+	memset(&rx, 0, sizeof(rx));
+	mctp_set_alloc_ops(malloc, free, test_msg_alloc, test_msg_free);
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_rx_all(mctp, rx_message_data, &rx);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	test_msg_allocs = 0;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM, &pktbuf);
+
+	assert(rx.seen);
+	assert(rx.len == MCTP_BTU);
+	assert(memcmp(rx.buf, test_payload, MCTP_BTU) == 0);
+	assert(test_msg_allocs == 0);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+struct test_take {
+	struct mctp *mctp;
+	void *msg;
+	void *taken;
+	size_t len;
+};
+
+static void rx_message_take(uint8_t eid __unused, bool tag_owner __unused,
+			    uint8_t msg_tag __unused, void *data, void *msg,
+			    size_t len)
+{
+	struct test_take *t = data;
+
+	t->msg = msg;
+	t->len = len;
+	t->taken = mctp_rx_msg_take(t->mctp);
+	assert(t->taken);
+	/* Only one owner */
+	assert(!mctp_rx_msg_take(t->mctp));
+}
+
+/*
+ * mctp_rx_msg_take() keeps a message past the callback: single-packet
+ * messages are copied, reassembled messages are handed over.
+ */
+static void mctp_core_test_rx_msg_take()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_take t;
+	uint8_t test_payload[2 * MCTP_BTU];
+	struct pktbuf pktbuf;
+	size_t i;
+
+	for (i = 0; i < sizeof(test_payload); i++)
+		test_payload[i] = i;
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	memset(&t, 0, sizeof(t));
+	t.mctp = mctp;
+	mctp_set_rx_all(mctp, rx_message_take, &t);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	assert(!mctp_rx_msg_take(mctp));
+
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM, &pktbuf);
+	assert(t.taken && t.taken != t.msg);
+	assert(t.len == MCTP_BTU);
+	assert(memcmp(t.taken, test_payload, MCTP_BTU) == 0);
+	__mctp_msg_free(t.taken, mctp);
+
+	memset(&t, 0, sizeof(t));
+	t.mctp = mctp;
+	receive_two_fragment_message(binding, test_payload, MCTP_BTU, MCTP_BTU,
+				     &pktbuf);
+	assert(t.taken && t.taken == t.msg);
+	assert(t.len == 2 * MCTP_BTU);
+	assert(memcmp(t.taken, test_payload, 2 * MCTP_BTU) == 0);
+	__mctp_msg_free(t.taken, mctp);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+struct test_rx_iov {
+	struct mctp *mctp;
+	size_t calls;
+	size_t iovcnt;
+	size_t len;
+	uint8_t buf[3 * MCTP_BTU];
+	void *taken;
+};
+
+static void rx_message_iov(uint8_t eid __unused, bool tag_owner __unused,
+			   uint8_t msg_tag __unused, void *data,
+			   const struct mctp_iovec *iov, size_t iovcnt,
+			   size_t len)
+{
+	struct test_rx_iov *t = data;
+	size_t i, pos;
+
+	t->calls++;
+	t->iovcnt = iovcnt;
+	t->len = len;
+	for (i = 0, pos = 0; i < iovcnt; pos += iov[i].len, i++) {
+		assert(pos + iov[i].len <= sizeof(t->buf));
+		memcpy(t->buf + pos, iov[i].base, iov[i].len);
+	}
+	assert(pos == len);
+
+	t->taken = mctp_rx_msg_take(t->mctp);
+}
+
+/*
+ * A scatter-gather receiver gets one region per fragment, and can still
+ * take a flat copy.
+ */
+static void mctp_core_test_rx_iov_chain()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	static struct test_rx_iov t;
+	uint8_t test_payload[3 * MCTP_BTU];
+	uint8_t tag = MCTP_HDR_FLAG_TO | get_tag();
+	struct pktbuf pktbuf;
+	size_t i;
+
+	for (i = 0; i < sizeof(test_payload); i++)
+		test_payload[i] = i * 7;
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	memset(&t, 0, sizeof(t));
+	t.mctp = mctp;
+	mctp_set_rx_iov(mctp, rx_message_iov, &t);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM |
+				     (get_sequence() << MCTP_HDR_SEQ_SHIFT) |
+				     tag,
+			     &pktbuf);
+	receive_one_fragment(binding, test_payload + MCTP_BTU, MCTP_BTU,
+			     (get_sequence() << MCTP_HDR_SEQ_SHIFT) | tag,
+			     &pktbuf);
+	receive_one_fragment(binding, test_payload + 2 * MCTP_BTU, 16,
+			     MCTP_HDR_FLAG_EOM |
+				     (get_sequence() << MCTP_HDR_SEQ_SHIFT) |
+				     tag,
+			     &pktbuf);
+
+	assert(t.calls == 1);
+	assert(t.iovcnt == 3);
+	assert(t.len == 2 * MCTP_BTU + 16);
+	assert(memcmp(t.buf, test_payload, t.len) == 0);
+	assert(t.taken);
+	assert(memcmp(t.taken, test_payload, t.len) == 0);
+	__mctp_msg_free(t.taken, mctp);
+
+	/* Single-packet messages are a single region */
+	memset(&t, 0, sizeof(t));
+	t.mctp = mctp;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM, &pktbuf);
+	assert(t.calls == 1);
+	assert(t.iovcnt == 1);
+	assert(t.len == MCTP_BTU);
+	assert(memcmp(t.buf, test_payload, MCTP_BTU) == 0);
+	assert(t.taken);
+	__mctp_msg_free(t.taken, mctp);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+/* Open a reassembly context from each of @n consecutive source EIDs */
+static void open_contexts(struct mctp_binding_test *binding, uint8_t *payload,
+			  uint8_t tag, mctp_eid_t src, int n,
+			  struct pktbuf *pktbuf)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		pktbuf->hdr.src = src + i;
+		receive_one_fragment(binding, payload, MCTP_BTU,
+				     MCTP_HDR_FLAG_SOM | tag, pktbuf);
+	}
+}
+
+/*
+ * With all contexts in use, a new message evicts one that has been open
+ * for longer than the reassembly timeout.
+ */
+static void mctp_core_test_reassembly_timeout()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_params test_param;
+	static uint8_t test_payload[2 * MCTP_BTU];
+	uint8_t tag = MCTP_HDR_FLAG_TO | get_tag();
+	struct pktbuf pktbuf;
+
+	memset(&test_param, 0, sizeof(test_param));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_now_op(mctp, test_now, NULL);
+	mctp_set_reassembly_timeout(mctp, 100);
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+
+	test_now_ms = 1000;
+	open_contexts(binding, test_payload, tag, TEST_SRC_EID,
+		      MCTP_REASSEMBLY_CTXS, &pktbuf);
+
+	/* Nothing has timed out yet, so the new message is dropped */
+	test_now_ms += 99;
+	pktbuf.hdr.src = TEST_SRC_EID + MCTP_REASSEMBLY_CTXS;
+	receive_two_fragment_message(binding, test_payload, MCTP_BTU, MCTP_BTU,
+				     &pktbuf);
+	assert(!test_param.seen);
+
+	test_now_ms += 1;
+	receive_two_fragment_message(binding, test_payload, MCTP_BTU, MCTP_BTU,
+				     &pktbuf);
+	assert(test_param.seen);
+	assert(test_param.message_size == 2 * MCTP_BTU);
+
+	/* The first context was evicted, the second is still open */
+	test_param.seen = false;
+	pktbuf.hdr.src = TEST_SRC_EID;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_EOM | (1 << MCTP_HDR_SEQ_SHIFT) | tag,
+			     &pktbuf);
+	assert(!test_param.seen);
+	pktbuf.hdr.src = TEST_SRC_EID + 1;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_EOM | (1 << MCTP_HDR_SEQ_SHIFT) | tag,
+			     &pktbuf);
+	assert(test_param.seen);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+/*
+ * With LRU eviction enabled, a new message evicts the least recently used
+ * context even if none has timed out.
+ */
+static void mctp_core_test_reassembly_evict_lru()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_params test_param;
+	static uint8_t test_payload[3 * MCTP_BTU];
+	uint8_t tag = MCTP_HDR_FLAG_TO | get_tag();
+	struct pktbuf pktbuf;
+
+	memset(&test_param, 0, sizeof(test_param));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_reassembly_evict_lru(mctp, true);
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+
+	open_contexts(binding, test_payload, tag, TEST_SRC_EID,
+		      MCTP_REASSEMBLY_CTXS, &pktbuf);
+
+	/* Touch the first context, leaving the second least recently used */
+	pktbuf.hdr.src = TEST_SRC_EID;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     (1 << MCTP_HDR_SEQ_SHIFT) | tag, &pktbuf);
+
+	pktbuf.hdr.src = TEST_SRC_EID + MCTP_REASSEMBLY_CTXS;
+	receive_two_fragment_message(binding, test_payload, MCTP_BTU, MCTP_BTU,
+				     &pktbuf);
+	assert(test_param.seen);
+
+	test_param.seen = false;
+	pktbuf.hdr.src = TEST_SRC_EID + 1;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_EOM | (1 << MCTP_HDR_SEQ_SHIFT) | tag,
+			     &pktbuf);
+	assert(!test_param.seen);
+
+	pktbuf.hdr.src = TEST_SRC_EID;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_EOM | (2 << MCTP_HDR_SEQ_SHIFT) | tag,
+			     &pktbuf);
+	assert(test_param.seen);
+	assert(test_param.message_size == 3 * MCTP_BTU);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+struct test_stream {
+	int starts;
+	int datas;
+	int ends;
+	int aborts;
+	size_t len;
+	size_t end_len;
+	uint8_t buf[4 * MCTP_BTU];
+};
+
+static void rx_stream(uint8_t eid __unused, bool tag_owner __unused,
+		      uint8_t msg_tag __unused, void *data,
+		      enum mctp_stream_event event, const void *buf, size_t len)
+{
+	struct test_stream *t = data;
+
+	switch (event) {
+	case MCTP_STREAM_START:
+		t->starts++;
+		t->len = 0;
+		break;
+	case MCTP_STREAM_DATA:
+		assert(t->len + len <= sizeof(t->buf));
+		memcpy(t->buf + t->len, buf, len);
+		t->len += len;
+		t->datas++;
+		break;
+	case MCTP_STREAM_END:
+		t->ends++;
+		t->end_len = len;
+		break;
+	case MCTP_STREAM_ABORT:
+		t->aborts++;
+		t->end_len = len;
+		break;
+	}
+}
+
+/*
+ * Stream handlers get each fragment as it arrives, are not limited by the
+ * max message size, and see an abort when a message is dropped.
+ */
+static void mctp_core_test_rx_stream()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_params test_param;
+	static struct test_stream t;
+	static uint8_t test_payload[4 * MCTP_BTU];
+	uint8_t tag = MCTP_HDR_FLAG_TO | get_tag();
+	struct pktbuf pktbuf;
+	size_t i;
+
+	for (i = 0; i < sizeof(test_payload); i++)
+		test_payload[i] = i;
+	test_payload[0] = 0x7e;
+	memset(&test_param, 0, sizeof(test_param));
+	memset(&t, 0, sizeof(t));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_max_message_size(mctp, 2 * MCTP_BTU);
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+	assert(mctp_set_stream_handler(mctp, 0x7e, MCTP_STREAM_ANY, rx_stream,
+				       &t) == 0);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	for (i = 0; i < 4; i++) {
+		uint8_t flags = (i << MCTP_HDR_SEQ_SHIFT) | tag;
+
+		if (i == 0)
+			flags |= MCTP_HDR_FLAG_SOM;
+		if (i == 3)
+			flags |= MCTP_HDR_FLAG_EOM;
+		receive_one_fragment(binding, test_payload + i * MCTP_BTU,
+				     MCTP_BTU, flags, &pktbuf);
+		assert(t.datas == (int)i + 1);
+	}
+
+	assert(t.starts == 1 && t.ends == 1 && !t.aborts);
+	assert(t.end_len == 4 * MCTP_BTU);
+	assert(memcmp(t.buf, test_payload, t.end_len) == 0);
+	assert(!test_param.seen);
+
+	/* A sequence error aborts the stream */
+	memset(&t, 0, sizeof(t));
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | tag, &pktbuf);
+	receive_one_fragment(binding, test_payload + MCTP_BTU, MCTP_BTU,
+			     (2 << MCTP_HDR_SEQ_SHIFT) | tag, &pktbuf);
+	assert(t.starts == 1 && !t.ends && t.aborts == 1);
+	assert(t.end_len == MCTP_BTU);
+
+	/* Single-packet messages are streamed too */
+	memset(&t, 0, sizeof(t));
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM | tag,
+			     &pktbuf);
+	assert(t.starts == 1 && t.datas == 1 && t.ends == 1);
+	assert(t.end_len == MCTP_BTU);
+
+	/* Removing the handler aborts a message in progress */
+	memset(&t, 0, sizeof(t));
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | tag, &pktbuf);
+	assert(mctp_set_stream_handler(mctp, 0x7e, MCTP_STREAM_ANY, NULL,
+				       NULL) == 0);
+	assert(t.aborts == 1);
+
+	/* Other messages are reassembled as usual */
+	receive_two_fragment_message(binding, test_payload, MCTP_BTU, MCTP_BTU,
+				     &pktbuf);
+	assert(test_param.seen);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+/*
+ * The most specific stream handler is used, and wildcard types leave
+ * control messages alone.
+ */
+static void mctp_core_test_rx_stream_match()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_params test_param;
+	static struct test_stream any, by_type, by_src;
+	uint8_t test_payload[MCTP_BTU];
+	struct pktbuf pktbuf;
+
+	memset(test_payload, 0, sizeof(test_payload));
+	memset(&test_param, 0, sizeof(test_param));
+	memset(&any, 0, sizeof(any));
+	memset(&by_type, 0, sizeof(by_type));
+	memset(&by_src, 0, sizeof(by_src));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+	assert(!mctp_set_stream_handler(mctp, MCTP_STREAM_ANY, MCTP_STREAM_ANY,
+					rx_stream, &any));
+	assert(!mctp_set_stream_handler(mctp, 0x05, MCTP_STREAM_ANY, rx_stream,
+					&by_type));
+	assert(!mctp_set_stream_handler(mctp, MCTP_STREAM_ANY, TEST_SRC_EID,
+					rx_stream, &by_src));
+	assert(mctp_set_stream_handler(mctp, 0x06, 1, NULL, NULL) == -ENOENT);
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	/* Type match wins over source match, IC bit ignored */
+	test_payload[0] = MCTP_MSG_FLAG_IC | 0x05;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM, &pktbuf);
+	assert(by_type.ends == 1 && !by_src.ends && !any.ends);
+
+	test_payload[0] = 0x06;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM, &pktbuf);
+	assert(by_src.ends == 1 && !any.ends);
+
+	pktbuf.hdr.src = TEST_SRC_EID + 1;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM, &pktbuf);
+	assert(any.ends == 1);
+
+	/* Control messages go through the normal path */
+	test_payload[0] = MCTP_CTRL_HDR_MSG_TYPE;
+	receive_one_fragment(binding, test_payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM, &pktbuf);
+	assert(any.ends == 1);
+	assert(test_param.seen);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+static bool test_tx_busy;
+static int test_tx_count;
+
+/* Loopback tx that can be made to report a busy binding */
+static int test_busy_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
+{
+	if (test_tx_busy)
+		return -EBUSY;
+
+	test_tx_count++;
+	mctp_bus_rx(b, pkt);
+	return 0;
+}
+
+struct test_rx_order {
+	int count;
+	uint8_t first[8];
+};
+
+static void rx_message_order(uint8_t eid __unused, bool tag_owner __unused,
+			     uint8_t msg_tag __unused, void *data, void *msg,
+			     size_t len __unused)
+{
+	struct test_rx_order *t = data;
+
+	if (t->count < (int)ARRAY_SIZE(t->first))
+		t->first[t->count] = *(uint8_t *)msg;
+	t->count++;
+}
+
+/*
+ * Messages queue behind a busy binding up to the depth and byte limits,
+ * then drain in order once it is ready again.
+ */
+static void mctp_core_test_tx_queue()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct mctp_binding *b;
+	struct test_rx_order t;
+	uint8_t msg[200];
+	int i, rc;
+
+	memset(&t, 0, sizeof(t));
+	/* A non-control type, control messages have their own queue */
+	memset(msg, 0x10, sizeof(msg));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx = test_busy_tx;
+	mctp_set_rx_all(mctp, rx_message_order, &t);
+	mctp_set_tx_queue_limits(mctp, 3, 100);
+
+	/* Depth limit */
+	test_tx_busy = true;
+	for (i = 0; i < 3; i++) {
+		msg[0] = 0x10 + i;
+		rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, 10);
+		assert(rc == 0);
+	}
+	assert(!mctp_is_tx_ready(mctp, TEST_DEST_EID));
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, 10);
+	assert(rc == -EBUSY);
+	assert(t.count == 0);
+
+	test_tx_busy = false;
+	mctp_binding_set_tx_enabled(b, true);
+	assert(t.count == 3);
+	for (i = 0; i < 3; i++)
+		assert(t.first[i] == 0x10 + i);
+	assert(mctp_is_tx_ready(mctp, TEST_DEST_EID));
+
+	/* Byte limit, except for a message onto an empty queue */
+	memset(&t, 0, sizeof(t));
+	test_tx_busy = true;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, 80);
+	assert(rc == 0);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, 30);
+	assert(rc == -EBUSY);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, 20);
+	assert(rc == 0);
+	test_tx_busy = false;
+	mctp_binding_set_tx_enabled(b, true);
+	assert(t.count == 2);
+
+	test_tx_busy = true;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, sizeof(msg));
+	assert(rc == 0);
+	test_tx_busy = false;
+	test_tx_count = 0;
+	mctp_binding_set_tx_enabled(b, true);
+	assert(t.count == 3);
+	assert(test_tx_count == (sizeof(msg) + MCTP_BTU - 1) / MCTP_BTU);
+
+	/* Queued messages are released with the bus */
+	test_tx_busy = true;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, 10);
+	assert(rc == 0);
+	test_tx_busy = false;
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+static int test_gather_count;
+
+/* Loopback gather tx: reassemble the packet to pass it back in */
+static int test_gather_tx(struct mctp_binding *b, const struct mctp_hdr *hdr,
+			  const void *payload, size_t len)
+{
+	struct mctp_pktbuf *pkt;
+
+	test_gather_count++;
+	pkt = mctp_pktbuf_alloc(b, 0);
+	assert(pkt);
+	assert(!mctp_pktbuf_push(pkt, hdr, sizeof(*hdr)));
+	assert(!mctp_pktbuf_push(pkt, payload, len));
+	mctp_bus_rx(b, pkt);
+	mctp_pktbuf_free(pkt);
+	return 0;
+}
+
+static void test_capture(struct mctp_pktbuf *pkt __unused, bool outgoing,
+			 void *user)
+{
+	if (outgoing)
+		(*(int *)user)++;
+}
+
+/*
+ * Bindings with a gather op get packets as header and payload, except
+ * when a capture handler needs a pktbuf.
+ */
+static void mctp_core_test_tx_gather()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	static struct test_rx_data rx;
+	struct mctp_binding *b;
+	uint8_t msg[3 * MCTP_BTU];
+	int captured = 0;
+	size_t i;
+	int rc;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i;
+	memset(&rx, 0, sizeof(rx));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx = test_busy_tx;
+	b->tx_gather = test_gather_tx;
+	mctp_set_rx_all(mctp, rx_message_data, &rx);
+
+	test_tx_busy = false;
+	test_tx_count = 0;
+	test_gather_count = 0;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, sizeof(msg));
+	assert(rc == 0);
+	assert(test_gather_count == 3 && test_tx_count == 0);
+	assert(rx.seen && rx.len == sizeof(msg));
+	assert(memcmp(rx.buf, msg, sizeof(msg)) == 0);
+
+	memset(&rx, 0, sizeof(rx));
+	mctp_set_capture_handler(mctp, test_capture, &captured);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, sizeof(msg));
+	assert(rc == 0);
+	assert(test_gather_count == 3 && test_tx_count == 3);
+	assert(captured == 3);
+	assert(rx.seen && rx.len == sizeof(msg));
+	assert(memcmp(rx.buf, msg, sizeof(msg)) == 0);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+static size_t test_batch_calls;
+static size_t test_batch_largest;
+/* Packets to accept in the next call, unlimited if negative */
+static int test_batch_accept = -1;
+/* Run once by the next call, as an RX callback queueing a reply would */
+static void (*test_batch_hook)(struct mctp *mctp);
+
+static int test_batch_tx(struct mctp_binding *b,
+			 struct mctp_pktbuf *const *pkts, size_t n)
+{
+	void (*hook)(struct mctp *mctp) = test_batch_hook;
+	size_t i;
+
+	if (hook) {
+		test_batch_hook = NULL;
+		hook(b->mctp);
+	}
+
+	test_batch_calls++;
+	test_batch_largest = MAX(test_batch_largest, n);
+	if (test_batch_accept >= 0 && n > (size_t)test_batch_accept)
+		n = test_batch_accept;
+
+	for (i = 0; i < n; i++)
+		mctp_bus_rx(b, pkts[i]);
+
+	return n;
+}
+
+static int test_batch_rx;
+
+/* Tag 1 carries the whole of @data, tag 2 all but its first byte */
+static void rx_message_batch(uint8_t eid __unused, bool tag_owner __unused,
+			     uint8_t msg_tag, void *data, void *msg, size_t len)
+{
+	const uint8_t *expect = data;
+	size_t expect_len = 20 * MCTP_BTU;
+
+	if (msg_tag == 2) {
+		expect++;
+		expect_len--;
+	}
+	assert(len == expect_len);
+	assert(memcmp(msg, expect, len) == 0);
+	test_batch_rx++;
+}
+
+/*
+ * Bindings with a batch op get many packets per call, and can take only
+ * part of a batch.
+ */
+static void mctp_core_test_tx_batch()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	static struct test_rx_data rx;
+	struct mctp_binding *b;
+	static uint8_t msg[20 * MCTP_BTU];
+	size_t i;
+	int rc;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i * 3;
+	memset(&rx, 0, sizeof(rx));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx_batch = test_batch_tx;
+	mctp_set_rx_all(mctp, rx_message_data, &rx);
+
+	test_batch_calls = 0;
+	test_batch_largest = 0;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, sizeof(msg));
+	assert(rc == 0);
+	assert(test_batch_calls == 3 && test_batch_largest == 8);
+	assert(rx.seen && rx.len == sizeof(msg));
+	assert(memcmp(rx.buf, msg, sizeof(msg)) == 0);
+
+	/* A short batch stops the queue until the binding is ready */
+	memset(&rx, 0, sizeof(rx));
+	test_batch_calls = 0;
+	test_batch_accept = 3;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 0, msg, sizeof(msg));
+	assert(rc == 0);
+	assert(test_batch_calls == 1 && !rx.seen);
+	test_batch_accept = -1;
+	mctp_binding_set_tx_enabled(b, true);
+	assert(rx.seen && rx.len == sizeof(msg));
+	assert(memcmp(rx.buf, msg, sizeof(msg)) == 0);
+
+	/* Interleaved messages survive short batches */
+	test_batch_accept = 3;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == 0);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 2, msg + 1,
+			     sizeof(msg) - 1);
+	assert(rc == 0);
+	mctp_set_rx_all(mctp, rx_message_batch, msg);
+	test_batch_rx = 0;
+	for (i = 0; i < 20 && test_batch_rx < 2; i++)
+		mctp_binding_set_tx_enabled(b, true);
+	assert(test_batch_rx == 2);
+	test_batch_accept = -1;
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+struct test_rx_log {
+	int count;
+	size_t len[8];
+	uint8_t tag[8];
+};
+
+static void rx_message_log(uint8_t eid __unused, bool tag_owner __unused,
+			   uint8_t msg_tag, void *data, void *msg __unused,
+			   size_t len)
+{
+	struct test_rx_log *log = data;
+
+	assert(log->count < (int)ARRAY_SIZE(log->len));
+	log->len[log->count] = len;
+	log->tag[log->count] = msg_tag;
+	log->count++;
+}
+
+/*
+ * Packets of queued messages with different tags interleave, so a short
+ * message is not held up behind a long one. Messages of the same flow are
+ * still sent one after the other.
+ */
+static void mctp_core_test_tx_interleave()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct mctp_binding *b;
+	struct test_rx_log log;
+	static uint8_t msg[8 * MCTP_BTU];
+	int rc;
+
+	memset(&log, 0, sizeof(log));
+	memset(msg, 0x5a, sizeof(msg));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx = test_busy_tx;
+	mctp_set_rx_all(mctp, rx_message_log, &log);
+
+	test_tx_busy = true;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == 0);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == 0);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 2, msg, 10);
+	assert(rc == 0);
+	test_tx_busy = false;
+	test_tx_count = 0;
+	mctp_binding_set_tx_enabled(b, true);
+
+	assert(log.count == 3);
+	assert(log.tag[0] == 2 && log.len[0] == 10);
+	assert(log.tag[1] == 1 && log.len[1] == sizeof(msg));
+	assert(log.tag[2] == 1 && log.len[2] == sizeof(msg));
+	assert(test_tx_count == 17);
+
+	/* In order with interleaving disabled */
+	memset(&log, 0, sizeof(log));
+	mctp_set_tx_interleave(mctp, 1, 1);
+	test_tx_busy = true;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == 0);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 2, msg, 10);
+	assert(rc == 0);
+	test_tx_busy = false;
+	mctp_binding_set_tx_enabled(b, true);
+
+	assert(log.count == 2);
+	assert(log.tag[0] == 1 && log.tag[1] == 2);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+/*
+ * Control and urgent messages have their own queue and are sent ahead of
+ * bulk messages, which still get a packet after every few urgent ones.
+ */
+static void mctp_core_test_tx_priority()
+{
+	struct mctp_tx_opts opts = { .tx_class = MCTP_TX_CLASS_URGENT };
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct mctp_binding *b;
+	struct test_rx_log log;
+	uint8_t msg[2 * MCTP_BTU];
+	uint8_t ctrl[10];
+	void *buf;
+	int i, rc;
+
+	memset(&log, 0, sizeof(log));
+	memset(msg, 0x5a, sizeof(msg));
+	memset(ctrl, 0, sizeof(ctrl));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx = test_busy_tx;
+	mctp_set_rx_all(mctp, rx_message_log, &log);
+	mctp_set_tx_queue_limits(mctp, 1, 1024);
+
+	/* Accepted while the bulk queue is full, and sent first */
+	test_tx_busy = true;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == 0);
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == -EBUSY);
+	assert(!mctp_is_tx_ready(mctp, TEST_DEST_EID));
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 2, ctrl, sizeof(ctrl));
+	assert(rc == 0);
+	buf = __mctp_msg_alloc(10, mctp);
+	memcpy(buf, msg, 10);
+	rc = mctp_message_tx_opts(mctp, TEST_DEST_EID, false, 3, buf, 10,
+				  &opts);
+	assert(rc == 0);
+	test_tx_busy = false;
+	mctp_binding_set_tx_enabled(b, true);
+
+	assert(log.count == 3);
+	assert(log.tag[0] == 2 && log.len[0] == sizeof(ctrl));
+	assert(log.tag[1] == 3 && log.len[1] == 10);
+	assert(log.tag[2] == 1 && log.len[2] == sizeof(msg));
+
+	/* A bulk packet after every two urgent ones */
+	memset(&log, 0, sizeof(log));
+	mctp_set_tx_urgent_limits(mctp, 8, 1024, 2);
+	test_tx_busy = true;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == 0);
+	for (i = 2; i <= 6; i++) {
+		buf = __mctp_msg_alloc(10, mctp);
+		memcpy(buf, msg, 10);
+		rc = mctp_message_tx_opts(mctp, TEST_DEST_EID, false, i, buf,
+					  10, &opts);
+		assert(rc == 0);
+	}
+	test_tx_busy = false;
+	mctp_binding_set_tx_enabled(b, true);
+
+	assert(log.count == 6);
+	assert(log.tag[0] == 2 && log.tag[1] == 3);
+	assert(log.tag[2] == 4 && log.tag[3] == 5);
+	assert(log.tag[4] == 1 && log.len[4] == sizeof(msg));
+	assert(log.tag[5] == 6);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+static uint8_t test_batch_msg[20 * MCTP_BTU];
+
+static void test_batch_queue_bulk(struct mctp *mctp)
+{
+	int rc;
+
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 2, test_batch_msg + 1,
+			     sizeof(test_batch_msg) - 1);
+	assert(rc == 0);
+}
+
+static void test_batch_queue_ctrl(struct mctp *mctp)
+{
+	uint8_t ctrl[10];
+	int rc;
+
+	memset(ctrl, 0, sizeof(ctrl));
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 3, ctrl, sizeof(ctrl));
+	assert(rc == 0);
+}
+
+/*
+ * Messages queued while the binding sends a batch, by its RX path or by
+ * another thread, don't change which messages the sent packets belonged
+ * to.
+ */
+static void mctp_core_test_tx_batch_queued()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct mctp_binding *b;
+	struct test_rx_log log;
+	size_t i;
+	int rc;
+
+	/* Not a control message, which would be sent urgently */
+	for (i = 0; i < sizeof(test_batch_msg); i++)
+		test_batch_msg[i] = i * 3 + 1;
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx_batch = test_batch_tx;
+
+	/* A bulk message joins the interleave */
+	mctp_set_rx_all(mctp, rx_message_batch, test_batch_msg);
+	test_batch_rx = 0;
+	test_batch_hook = test_batch_queue_bulk;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, test_batch_msg,
+			     sizeof(test_batch_msg));
+	assert(rc == 0);
+	assert(test_batch_rx == 2);
+
+	/* An urgent message takes the next turn */
+	memset(&log, 0, sizeof(log));
+	mctp_set_rx_all(mctp, rx_message_log, &log);
+	test_batch_hook = test_batch_queue_ctrl;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, test_batch_msg,
+			     sizeof(test_batch_msg));
+	assert(rc == 0);
+	assert(log.count == 2);
+	assert(log.tag[0] == 3 && log.len[0] == 10);
+	assert(log.tag[1] == 1 && log.len[1] == sizeof(test_batch_msg));
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+struct test_tx_done {
+	int count;
+	int status;
+	size_t sent;
+	uint64_t elapsed;
+};
+
+static void test_tx_done(int status, size_t sent, uint64_t elapsed,
+			 void *data)
+{
+	struct test_tx_done *d = data;
+
+	d->count++;
+	d->status = status;
+	d->sent = sent;
+	d->elapsed = elapsed;
+}
+
+/* Fails every packet after the first test_tx_fail_after */
+static int test_tx_fail_after;
+
+static int test_fail_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
+{
+	if (test_tx_busy)
+		return -EBUSY;
+	if (!test_tx_fail_after)
+		return -EIO;
+
+	test_tx_fail_after--;
+	mctp_bus_rx(b, pkt);
+	return 0;
+}
+
+/*
+ * The completion callback reports each message once it has been sent,
+ * dropped or cancelled, with the bytes sent and the time taken.
+ */
+static void mctp_core_test_tx_done()
+{
+	struct mctp_tx_opts opts = { 0 };
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct mctp_binding *b;
+	struct test_tx_done d;
+	uint8_t msg[4 * MCTP_BTU];
+	void *buf;
+	int rc;
+
+	memset(&d, 0, sizeof(d));
+	memset(msg, 0x5a, sizeof(msg));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	mctp_set_now_op(mctp, test_now, NULL);
+	b = (struct mctp_binding *)binding;
+	b->tx = test_fail_tx;
+	opts.done = test_tx_done;
+	opts.done_data = &d;
+
+	/* Sent */
+	test_now_ms = 1000;
+	test_tx_busy = true;
+	test_tx_fail_after = 8;
+	buf = __mctp_msg_alloc(sizeof(msg), mctp);
+	memcpy(buf, msg, sizeof(msg));
+	rc = mctp_message_tx_opts(mctp, TEST_DEST_EID, false, 0, buf,
+				  sizeof(msg), &opts);
+	assert(rc == 0);
+	assert(d.count == 0);
+	test_now_ms += 25;
+	test_tx_busy = false;
+	mctp_binding_set_tx_enabled(b, true);
+	assert(d.count == 1);
+	assert(d.status == 0);
+	assert(d.sent == sizeof(msg));
+	assert(d.elapsed == 25);
+
+	/* Dropped by the binding after two packets */
+	memset(&d, 0, sizeof(d));
+	test_tx_fail_after = 2;
+	buf = __mctp_msg_alloc(sizeof(msg), mctp);
+	memcpy(buf, msg, sizeof(msg));
+	rc = mctp_message_tx_opts(mctp, TEST_DEST_EID, false, 0, buf,
+				  sizeof(msg), &opts);
+	assert(rc == 0);
+	assert(d.count == 1);
+	assert(d.status == -EIO);
+	assert(d.sent == 2 * MCTP_BTU);
+
+	/* Cancelled with the bus */
+	memset(&d, 0, sizeof(d));
+	test_tx_busy = true;
+	buf = __mctp_msg_alloc(sizeof(msg), mctp);
+	memcpy(buf, msg, sizeof(msg));
+	rc = mctp_message_tx_opts(mctp, TEST_DEST_EID, false, 0, buf,
+				  sizeof(msg), &opts);
+	assert(rc == 0);
+	test_tx_busy = false;
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+	assert(d.count == 1);
+	assert(d.status == -ECANCELED);
+	assert(d.sent == 0);
+}
+
+/* Fails allocations of at least this many bytes, if nonzero */
+static size_t test_alloc_fail_size;
+
+static void *test_fail_alloc(size_t size)
+{
+	if (test_alloc_fail_size && size >= test_alloc_fail_size)
+		return NULL;
+	return malloc(size);
+}
+
+/*
+ * Without memory for a batch, packets go one at a time through tx, or the
+ * message fails if the binding has no tx op.
+ */
+static void mctp_core_test_tx_batch_nomem()
+{
+	struct mctp_tx_opts opts = { 0 };
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct mctp_binding *b;
+	struct test_rx_log log;
+	struct test_tx_done d;
+	uint8_t msg[MCTP_BTU];
+	void *buf;
+	int rc;
+
+	memset(&d, 0, sizeof(d));
+	memset(&log, 0, sizeof(log));
+	memset(msg, 0x5a, sizeof(msg));
+	mctp_set_alloc_ops(test_fail_alloc, free, test_msg_alloc,
+			   test_msg_free);
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx_batch = test_batch_tx;
+	mctp_set_rx_all(mctp, rx_message_log, &log);
+	opts.done = test_tx_done;
+	opts.done_data = &d;
+
+	/* The batch storage is larger than a queued message */
+	test_alloc_fail_size = 256;
+	test_batch_calls = 0;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 1, msg, sizeof(msg));
+	assert(rc == 0);
+	assert(log.count == 1 && log.len[0] == sizeof(msg));
+	assert(test_batch_calls == 0);
+
+	b->tx = NULL;
+	buf = __mctp_msg_alloc(sizeof(msg), mctp);
+	memcpy(buf, msg, sizeof(msg));
+	rc = mctp_message_tx_opts(mctp, TEST_DEST_EID, false, 2, buf,
+				  sizeof(msg), &opts);
+	assert(rc == 0);
+	assert(d.count == 1 && d.status == -ENOMEM);
+	assert(log.count == 1);
+
+	/* Batches once the storage can be had */
+	test_alloc_fail_size = 0;
+	rc = mctp_message_tx(mctp, TEST_DEST_EID, false, 3, msg, sizeof(msg));
+	assert(rc == 0);
+	assert(log.count == 2 && log.tag[1] == 3);
+	assert(test_batch_calls == 1);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+	mctp_set_alloc_ops(malloc, free, test_msg_alloc, test_msg_free);
+}
+
+/*
+ * A borrowed buffer is sent in place and handed back through the
+ * completion callback, immediately if the binding takes every packet.
+ */
+static void mctp_core_test_tx_borrowed()
+{
+	struct mctp_tx_opts opts = { 0 };
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct mctp_binding *b;
+	struct test_rx_log log;
+	struct test_tx_done d;
+	uint8_t msg[3 * MCTP_BTU];
+	int rc;
+
+	memset(&d, 0, sizeof(d));
+	memset(&log, 0, sizeof(log));
+	memset(msg, 0x5a, sizeof(msg));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx = test_busy_tx;
+	mctp_set_rx_all(mctp, rx_message_log, &log);
+
+	/* The callback is required */
+	rc = mctp_message_tx_borrowed(mctp, TEST_DEST_EID, false, 0, msg,
+				      sizeof(msg), NULL);
+	assert(rc == -EINVAL);
+	rc = mctp_message_tx_borrowed(mctp, TEST_DEST_EID, false, 0, msg,
+				      sizeof(msg), &opts);
+	assert(rc == -EINVAL);
+
+	opts.done = test_tx_done;
+	opts.done_data = &d;
+	rc = mctp_message_tx_borrowed(mctp, TEST_DEST_EID, false, 0, msg,
+				      sizeof(msg), &opts);
+	assert(rc == 0);
+	assert(d.count == 1 && d.status == 0 && d.sent == sizeof(msg));
+	assert(log.count == 1 && log.len[0] == sizeof(msg));
+
+	/* Held until the binding has taken the last packet */
+	memset(&d, 0, sizeof(d));
+	test_tx_busy = true;
+	rc = mctp_message_tx_borrowed(mctp, TEST_DEST_EID, false, 0, msg,
+				      sizeof(msg), &opts);
+	assert(rc == 0);
+	assert(d.count == 0);
+	test_tx_busy = false;
+	mctp_binding_set_tx_enabled(b, true);
+	assert(d.count == 1 && d.status == 0);
+	assert(log.count == 2 && log.len[1] == sizeof(msg));
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+/*
+ * A message given as regions is packetized across region boundaries.
+ * Packets within one region still go through the gather op.
+ */
+static void mctp_core_test_tx_iov()
+{
+	struct mctp_tx_opts opts = { 0 };
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	static struct test_rx_data rx;
+	struct mctp_binding *b;
+	struct mctp_iovec iov[4];
+	struct test_tx_done d;
+	uint8_t msg[2 * MCTP_BTU + 7];
+	size_t i;
+	int rc;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i + 1;
+	memset(&rx, 0, sizeof(rx));
+	memset(&d, 0, sizeof(d));
+	mctp_test_stack_init(&mctp, &binding, TEST_DEST_EID);
+	b = (struct mctp_binding *)binding;
+	b->tx = test_busy_tx;
+	b->tx_gather = test_gather_tx;
+	mctp_set_rx_all(mctp, rx_message_data, &rx);
+	opts.done = test_tx_done;
+	opts.done_data = &d;
+
+	/* Header, payload, an empty region and a trailer */
+	iov[0].base = msg;
+	iov[0].len = 3;
+	iov[1].base = msg + 3;
+	iov[1].len = 2 * MCTP_BTU;
+	iov[2].base = NULL;
+	iov[2].len = 0;
+	iov[3].base = msg + 3 + 2 * MCTP_BTU;
+	iov[3].len = 4;
+
+	rc = mctp_message_tx_iov(mctp, TEST_DEST_EID, false, 0, iov, 4, NULL);
+	assert(rc == -EINVAL);
+
+	test_tx_busy = false;
+	test_tx_count = 0;
+	test_gather_count = 0;
+	rc = mctp_message_tx_iov(mctp, TEST_DEST_EID, false, 0, iov, 4, &opts);
+	assert(rc == 0);
+	/* The first and last packets span regions */
+	assert(test_tx_count == 2 && test_gather_count == 1);
+	assert(d.count == 1 && d.status == 0 && d.sent == sizeof(msg));
+	assert(rx.seen && rx.len == sizeof(msg));
+	assert(memcmp(rx.buf, msg, sizeof(msg)) == 0);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+}
+
+struct test_resp {
+	int count;
+	int status;
+	uint8_t tag;
+	size_t len;
+	uint8_t buf[2 * MCTP_BTU];
+};
+
+static void test_resp(mctp_eid_t eid __unused, uint8_t msg_tag, int status,
+		      void *msg, size_t len, void *data)
+{
+	struct test_resp *r = data;
+
+	r->count++;
+	r->status = status;
+	r->tag = msg_tag;
+	r->len = len;
+	if (msg) {
+		assert(len <= sizeof(r->buf));
+		memcpy(r->buf, msg, len);
+	}
+}
+
+/*
+ * Responses to a request go to its response callback, ahead of stream
+ * handlers and the RX callback, and requests left unanswered time out or
+ * are cancelled with the bus.
+ */
+static void mctp_core_test_tx_request_cb()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	struct test_params test_param;
+	static struct test_stream t;
+	struct test_resp r1, r2;
+	uint8_t payload[2 * MCTP_BTU];
+	struct pktbuf pktbuf;
+	uint8_t tag1, tag2;
+	void *msg;
+	int rc;
+
+	memset(&r1, 0, sizeof(r1));
+	memset(&r2, 0, sizeof(r2));
+	memset(&t, 0, sizeof(t));
+	memset(&test_param, 0, sizeof(test_param));
+	memset(payload, 0x42, sizeof(payload));
+	mctp_test_stack_init(&mctp, &binding, 30);
+	mctp_set_now_op(mctp, test_now, NULL);
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+	mctp_set_stream_handler(mctp, MCTP_STREAM_ANY, MCTP_STREAM_ANY,
+				rx_stream, &t);
+	test_now_ms = 1000;
+
+	msg = __mctp_alloc(10);
+	memset(msg, 0x42, 10);
+	rc = mctp_message_tx_request_cb(mctp, 31, msg, 10, &tag1, test_resp,
+					&r1);
+	assert(rc == 0);
+	msg = __mctp_alloc(10);
+	memset(msg, 0x42, 10);
+	rc = mctp_message_tx_request_cb(mctp, 31, msg, 10, &tag2, test_resp,
+					&r2);
+	assert(rc == 0);
+	assert(tag1 != tag2);
+
+	/* Two-packet response to the second request */
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.ver = 1;
+	pktbuf.hdr.dest = 30;
+	pktbuf.hdr.src = 31;
+	receive_one_fragment(binding, payload, MCTP_BTU,
+			     MCTP_HDR_FLAG_SOM | tag2, &pktbuf);
+	receive_one_fragment(binding, payload + MCTP_BTU, MCTP_BTU,
+			     MCTP_HDR_FLAG_EOM | (1 << MCTP_HDR_SEQ_SHIFT) |
+				     tag2,
+			     &pktbuf);
+	assert(r2.count == 1 && r2.status == 0 && r2.tag == tag2);
+	assert(r2.len == sizeof(payload));
+	assert(memcmp(r2.buf, payload, sizeof(payload)) == 0);
+	assert(r1.count == 0);
+	assert(!test_param.seen && t.starts == 0);
+
+	/* The first times out */
+	test_now_ms += 6000;
+	mctp_check_timeouts(mctp);
+	assert(r1.count == 0);
+	test_now_ms += 1;
+	mctp_check_timeouts(mctp);
+	assert(r1.count == 1 && r1.status == -ETIMEDOUT && r1.tag == tag1);
+
+	/* A late response is an ordinary message */
+	receive_one_fragment(binding, payload, 10,
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM | tag1,
+			     &pktbuf);
+	assert(r1.count == 1);
+	assert(t.starts == 1);
+
+	/* Cancelled with the bus */
+	memset(&r1, 0, sizeof(r1));
+	msg = __mctp_alloc(10);
+	memset(msg, 0x42, 10);
+	rc = mctp_message_tx_request_cb(mctp, 31, msg, 10, &tag1, test_resp,
+					&r1);
+	assert(rc == 0);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+	assert(r1.count == 1 && r1.status == -ECANCELED);
+}
+
+static int test_tx_request_cb(struct mctp *mctp, mctp_eid_t eid,
+			      uint8_t *tag, struct test_resp *r)
+{
+	void *msg = __mctp_alloc(10);
+
+	memset(msg, 0x42, 10);
+	return mctp_message_tx_request_cb(mctp, eid, msg, 10, tag, test_resp,
+					  r);
+}
+
+/*
+ * Requests with a callback over the eight tags to a peer wait for a tag,
+ * and are sent in order as responses free them.
+ */
+static void mctp_core_test_tx_request_queue()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL;
+	static struct test_resp r[12];
+	struct mctp_req_stats stats;
+	uint8_t payload[10], tags[12];
+	struct pktbuf pktbuf;
+	int i;
+
+	memset(r, 0, sizeof(r));
+	memset(payload, 0x42, sizeof(payload));
+	mctp_test_stack_init(&mctp, &binding, 30);
+	mctp_set_now_op(mctp, test_now, NULL);
+	test_now_ms = 1000;
+
+	for (i = 0; i < 8; i++) {
+		assert(test_tx_request_cb(mctp, 31, &tags[i], &r[i]) == 0);
+		assert(tags[i] != MCTP_TAG_PENDING);
+	}
+	assert(test_tx_request_cb(mctp, 31, &tags[8], &r[8]) == 0);
+	assert(tags[8] == MCTP_TAG_PENDING);
+	assert(test_tx_request_cb(mctp, 31, &tags[9], &r[9]) == 0);
+
+	/* Full queue, other peers and requests without callbacks */
+	mctp_set_request_queue_limit(mctp, 2);
+	assert(test_tx_request_cb(mctp, 31, &tags[10], &r[10]) == -EBUSY);
+	assert(test_tx_request(mctp, 31, &tags[10]) == -EBUSY);
+	assert(test_tx_request_cb(mctp, 32, &tags[10], &r[10]) == 0);
+	assert(tags[10] != MCTP_TAG_PENDING);
+
+	mctp_get_request_stats(mctp, &stats);
+	assert(stats.pending == 2 && stats.max_pending == 2);
+	assert(stats.queued == 2 && stats.rejected == 1);
+
+	/* Each response sends the oldest waiting request on its tag */
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.ver = 1;
+	pktbuf.hdr.dest = 30;
+	pktbuf.hdr.src = 31;
+	receive_one_fragment(binding, payload, sizeof(payload),
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM | tags[0],
+			     &pktbuf);
+	assert(r[0].count == 1 && r[0].status == 0);
+	assert(r[8].count == 0 && r[9].count == 0);
+	mctp_get_request_stats(mctp, &stats);
+	assert(stats.pending == 1);
+
+	receive_one_fragment(binding, payload, sizeof(payload),
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM | tags[0],
+			     &pktbuf);
+	assert(r[8].count == 1 && r[8].status == 0 && r[8].tag == tags[0]);
+	assert(r[9].count == 0);
+	mctp_get_request_stats(mctp, &stats);
+	assert(stats.pending == 0);
+
+	/* Waiting requests are cancelled with the bus */
+	assert(test_tx_request_cb(mctp, 31, &tags[11], &r[11]) == 0);
+	assert(tags[11] == MCTP_TAG_PENDING);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(mctp);
+	assert(r[11].count == 1 && r[11].status == -ECANCELED);
+	for (i = 1; i < 11; i++) {
+		if (i != 8)
+			assert(r[i].count == 1 && r[i].status == -ECANCELED);
+	}
+}
+
+static struct mctp_binding *test_route_binding;
+
+static int test_route_tx(struct mctp_binding *b,
+			 struct mctp_pktbuf *pkt __unused)
+{
+	test_route_binding = b;
+	return 0;
+}
+
+/*
+ * Several busses can be registered. Messages go out on the bus routed for
+ * their destination, or the default route, and any local EID is accepted
+ * on any bus.
+ */
+static void mctp_core_test_multi_bus()
+{
+	struct mctp *mctp = NULL;
+	struct mctp_binding_test *binding = NULL, *binding2;
+	struct mctp_binding *b1, *b2;
+	struct test_params test_param;
+	uint8_t payload[10];
+	struct pktbuf pktbuf;
+
+	memset(payload, 0x10, sizeof(payload));
+	memset(&test_param, 0, sizeof(test_param));
+	mctp_test_stack_init(&mctp, &binding, 8);
+	binding2 = mctp_binding_test_init();
+	b1 = (struct mctp_binding *)binding;
+	b2 = (struct mctp_binding *)binding2;
+	assert(mctp_register_bus(mctp, b2, 9) == 0);
+	mctp_binding_set_tx_enabled(b2, true);
+	b1->tx = test_route_tx;
+	b2->tx = test_route_tx;
+	mctp_set_rx_all(mctp, rx_message, &test_param);
+
+	assert(mctp_set_route(mctp, 20, 29, b2) == 0);
+	assert(mctp_set_route(mctp, 30, 20, b2) == -EINVAL);
+
+	assert(mctp_message_tx(mctp, 25, false, 0, payload, 10) == 0);
+	assert(test_route_binding == b2);
+	assert(mctp_message_tx(mctp, 40, false, 0, payload, 10) == 0);
+	assert(test_route_binding == b1);
+
+	assert(mctp_set_default_route(mctp, b2) == 0);
+	assert(mctp_message_tx(mctp, 40, false, 0, payload, 10) == 0);
+	assert(test_route_binding == b2);
+	assert(mctp_set_default_route(mctp, NULL) == 0);
+	test_route_binding = NULL;
+	mctp_message_tx(mctp, 40, false, 0, payload, 10);
+	assert(test_route_binding == NULL);
+
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.ver = 1;
+	pktbuf.hdr.dest = 8;
+	pktbuf.hdr.src = 25;
+	receive_one_fragment(binding2, payload, sizeof(payload),
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM |
+				     MCTP_HDR_FLAG_TO,
+			     &pktbuf);
+	assert(test_param.seen);
+	test_param.seen = false;
+	pktbuf.hdr.dest = 50;
+	receive_one_fragment(binding2, payload, sizeof(payload),
+			     MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM |
+				     MCTP_HDR_FLAG_TO,
+			     &pktbuf);
+	assert(!test_param.seen);
+
+	/* Routes go with their bus */
+	mctp_unregister_bus(mctp, b2);
+	assert(mctp_set_route(mctp, 20, 29, b2) == -EINVAL);
+	assert(mctp_set_default_route(mctp, b1) == 0);
+	assert(mctp_message_tx(mctp, 25, false, 0, payload, 10) == 0);
+	assert(test_route_binding == b1);
+	assert(mctp_register_bus(mctp, b2, 9) == 0);
+	mctp_binding_set_tx_enabled(b2, true);
+	assert(mctp_set_route(mctp, 20, 29, b2) == 0);
+	assert(mctp_message_tx(mctp, 25, false, 0, payload, 10) == 0);
+	assert(test_route_binding == b2);
+
+	mctp_destroy(mctp);
+	mctp_binding_test_destroy(binding2);
+	mctp_binding_test_destroy(binding);
+}
+
+static struct {
+	struct mctp_binding *binding;
+	int count;
+	struct mctp_hdr hdr;
+	size_t len;
+	/* Header flags and payload length of each packet */
+	uint8_t flags[8];
+	size_t lens[8];
+	/* Packets to refuse with -EBUSY before accepting again */
+	int busy;
+} test_fwd;
+
+static int test_fwd_tx(struct mctp_binding *b, struct mctp_pktbuf *pkt)
+{
+	if (test_fwd.busy) {
+		test_fwd.busy--;
+		return -EBUSY;
+	}
+
+	test_fwd.binding = b;
+	test_fwd.hdr = *mctp_pktbuf_hdr(pkt);
+	test_fwd.len = mctp_pktbuf_size(pkt);
+	if (test_fwd.count < 8) {
+		test_fwd.flags[test_fwd.count] = test_fwd.hdr.flags_seq_tag;
+		test_fwd.lens[test_fwd.count] =
+			test_fwd.len - sizeof(struct mctp_hdr);
+	}
+	test_fwd.count++;
+	return 0;
+}
+
+static void test_fwd_rx(struct mctp_binding_test *binding, uint8_t *payload,
+			int i, int n, struct pktbuf *pktbuf)
+{
+	uint8_t flags = (uint8_t)(i << MCTP_HDR_SEQ_SHIFT) | MCTP_HDR_FLAG_TO |
+			3;
+
+	if (i == 0)
+		flags |= MCTP_HDR_FLAG_SOM;
+	if (i == n - 1)
+		flags |= MCTP_HDR_FLAG_EOM;
+	receive_one_fragment(binding, payload + i * MCTP_BTU, MCTP_BTU, flags,
+			     pktbuf);
+}
+
+/*
+ * A bridge passes each packet of a message on as it arrives, with its
+ * header unchanged, while the egress bus is idle. Otherwise the message is
+ * reassembled and queued.
+ */
+static void mctp_core_test_bridge_cut_through()
+{
+	struct mctp *mctp = mctp_init();
+	struct mctp_binding_test *binding1, *binding2;
+	static uint8_t payload[3 * MCTP_BTU];
+	struct mctp_binding *b1, *b2;
+	struct pktbuf pktbuf;
+	int i;
+
+	binding1 = mctp_binding_test_init();
+	binding2 = mctp_binding_test_init();
+	b1 = (struct mctp_binding *)binding1;
+	b2 = (struct mctp_binding *)binding2;
+	b1->tx = test_fwd_tx;
+	b2->tx = test_fwd_tx;
+	mctp_bridge_busses(mctp, b1, b2);
+	mctp_binding_set_tx_enabled(b1, true);
+	mctp_binding_set_tx_enabled(b2, true);
+
+	memset(payload, 0x5a, sizeof(payload));
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.ver = 1;
+	pktbuf.hdr.src = 10;
+	pktbuf.hdr.dest = 20;
+
+	memset(&test_fwd, 0, sizeof(test_fwd));
+	for (i = 0; i < 3; i++) {
+		test_fwd_rx(binding1, payload, i, 3, &pktbuf);
+		assert(test_fwd.count == i + 1 && test_fwd.binding == b2);
+		assert(test_fwd.hdr.flags_seq_tag == pktbuf.hdr.flags_seq_tag);
+		assert(test_fwd.hdr.src == 10 && test_fwd.hdr.dest == 20);
+		assert(test_fwd.len == sizeof(struct mctp_hdr) + MCTP_BTU);
+	}
+
+	/* Egress disabled at the start, so reassembled and queued */
+	memset(&test_fwd, 0, sizeof(test_fwd));
+	mctp_binding_set_tx_enabled(b2, false);
+	test_fwd_rx(binding1, payload, 0, 3, &pktbuf);
+	mctp_binding_set_tx_enabled(b2, true);
+	test_fwd_rx(binding1, payload, 1, 3, &pktbuf);
+	assert(test_fwd.count == 0);
+	test_fwd_rx(binding1, payload, 2, 3, &pktbuf);
+	assert(test_fwd.count == 3 && test_fwd.binding == b2);
+
+	/* Egress busy mid-message, so the rest is held and queued at EOM to
+	 * continue the message */
+	memset(&test_fwd, 0, sizeof(test_fwd));
+	test_fwd_rx(binding1, payload, 0, 3, &pktbuf);
+	mctp_binding_set_tx_enabled(b2, false);
+	test_fwd_rx(binding1, payload, 1, 3, &pktbuf);
+	mctp_binding_set_tx_enabled(b2, true);
+	assert(test_fwd.count == 1);
+	test_fwd_rx(binding1, payload, 2, 3, &pktbuf);
+	assert(test_fwd.count == 3);
+	assert(test_fwd.flags[1] ==
+	       ((1 << MCTP_HDR_SEQ_SHIFT) | MCTP_HDR_FLAG_TO | 3));
+	assert(test_fwd.flags[2] == (MCTP_HDR_FLAG_EOM |
+				     (2 << MCTP_HDR_SEQ_SHIFT) |
+				     MCTP_HDR_FLAG_TO | 3));
+	assert(test_fwd.lens[1] == MCTP_BTU && test_fwd.lens[2] == MCTP_BTU);
+
+	mctp_destroy(mctp);
+	mctp_binding_test_destroy(binding2);
+	mctp_binding_test_destroy(binding1);
+}
+
+/*
+ * A bridge between busses with different packet sizes re-slices messages
+ * as they pass, with the egress packets numbered from SOM.
+ */
+static void mctp_core_test_bridge_mtu()
+{
+	struct mctp *mctp = mctp_init();
+	struct mctp_binding_test *binding1, *binding2;
+	static uint8_t payload[5 * MCTP_BTU];
+	static PKTBUF_STORAGE_ALIGN_DECL uint8_t tx_storage[MCTP_PKTBUF_SIZE(
+		2 * MCTP_BTU)] PKTBUF_STORAGE_ALIGN;
+	uint8_t som = MCTP_HDR_FLAG_SOM, eom = MCTP_HDR_FLAG_EOM;
+	uint8_t tag = MCTP_HDR_FLAG_TO | 3;
+	struct mctp_binding *b1, *b2;
+	struct mctp_pktbuf *pkt;
+	struct pktbuf pktbuf;
+	int i;
+
+	binding1 = mctp_binding_test_init();
+	binding2 = mctp_binding_test_init();
+	b1 = (struct mctp_binding *)binding1;
+	b2 = (struct mctp_binding *)binding2;
+	b1->tx = test_fwd_tx;
+	b2->tx = test_fwd_tx;
+	b2->pkt_size = MCTP_PACKET_SIZE(2 * MCTP_BTU);
+	b2->tx_storage = tx_storage;
+	mctp_bridge_busses(mctp, b1, b2);
+	mctp_binding_set_tx_enabled(b1, true);
+	mctp_binding_set_tx_enabled(b2, true);
+
+	memset(payload, 0x5a, sizeof(payload));
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.ver = 1;
+	pktbuf.hdr.src = 10;
+	pktbuf.hdr.dest = 20;
+
+	/* Five small packets coalesce into two large ones and the rest */
+	memset(&test_fwd, 0, sizeof(test_fwd));
+	for (i = 0; i < 5; i++) {
+		test_fwd_rx(binding1, payload, i, 5, &pktbuf);
+		assert(test_fwd.count == (i < 2 ? 0 : i < 4 ? 1 : 3));
+	}
+	assert(test_fwd.binding == b2);
+	assert(test_fwd.flags[0] == (som | tag));
+	assert(test_fwd.flags[1] == ((1 << MCTP_HDR_SEQ_SHIFT) | tag));
+	assert(test_fwd.flags[2] == (eom | (2 << MCTP_HDR_SEQ_SHIFT) | tag));
+	assert(test_fwd.lens[0] == 2 * MCTP_BTU);
+	assert(test_fwd.lens[1] == 2 * MCTP_BTU);
+	assert(test_fwd.lens[2] == MCTP_BTU);
+
+	/* Large packets are split */
+	memset(&test_fwd, 0, sizeof(test_fwd));
+	pkt = mctp_pktbuf_alloc(b2, MCTP_PACKET_SIZE(2 * MCTP_BTU));
+	*mctp_pktbuf_hdr(pkt) = pktbuf.hdr;
+	mctp_pktbuf_hdr(pkt)->flags_seq_tag = som | tag;
+	memcpy(mctp_pktbuf_data(pkt), payload, 2 * MCTP_BTU);
+	mctp_bus_rx(b2, pkt);
+	mctp_pktbuf_free(pkt);
+	assert(test_fwd.count == 1);
+	receive_one_fragment(binding2, payload, 40,
+			     eom | (1 << MCTP_HDR_SEQ_SHIFT) | tag, &pktbuf);
+	assert(test_fwd.count == 3 && test_fwd.binding == b1);
+	assert(test_fwd.flags[0] == (som | tag));
+	assert(test_fwd.flags[2] == (eom | (2 << MCTP_HDR_SEQ_SHIFT) | tag));
+	assert(test_fwd.lens[0] == MCTP_BTU && test_fwd.lens[1] == MCTP_BTU);
+	assert(test_fwd.lens[2] == 40);
+
+	/* An egress packet refused mid-message is kept, with the rest */
+	memset(&test_fwd, 0, sizeof(test_fwd));
+	for (i = 0; i < 5; i++) {
+		if (i == 4)
+			test_fwd.busy = 1;
+		test_fwd_rx(binding1, payload, i, 5, &pktbuf);
+	}
+	assert(test_fwd.count == 3);
+	assert(test_fwd.flags[1] == ((1 << MCTP_HDR_SEQ_SHIFT) | tag));
+	assert(test_fwd.flags[2] == (eom | (2 << MCTP_HDR_SEQ_SHIFT) | tag));
+	assert(test_fwd.lens[2] == MCTP_BTU);
+
+	mctp_destroy(mctp);
+	mctp_binding_test_destroy(binding2);
+	mctp_binding_test_destroy(binding1);
+}
+
+#if MCTP_THREAD_SAFE && !defined(_WIN32)
+#define TEST_THREAD_MSGS 2000
+
+static struct {
+	struct mctp *mctp;
+	size_t tx_pkts;
+	size_t rx_msgs;
+} test_thread;
+
+static int test_thread_tx(struct mctp_binding *b __unused,
+			  struct mctp_pktbuf *pkt __unused)
+{
+	test_thread.tx_pkts++;
+	return 0;
+}
+
+/* Replies go out from the RX thread while the TX thread is sending */
+static void test_thread_rx(uint8_t eid, bool tag_owner __unused,
+			   uint8_t msg_tag, void *data __unused,
+			   void *msg __unused, size_t len __unused)
+{
+	uint8_t reply = 0;
+	int rc;
+
+	test_thread.rx_msgs++;
+	while ((rc = mctp_message_tx(test_thread.mctp, eid, false, msg_tag,
+				     &reply, sizeof(reply))) == -EBUSY)
+		sched_yield();
+	assert(rc == 0);
+}
+
+/* The counting hooks of the earlier tests are not thread safe */
+static void *test_thread_msg_alloc(size_t size, void *ctx __unused)
+{
+	return malloc(size);
+}
+
+static void test_thread_msg_free(void *msg, void *ctx __unused)
+{
+	free(msg);
+}
+
+static void *test_thread_send(void *arg __unused)
+{
+	static uint8_t payload[2 * MCTP_BTU];
+	int i, rc;
+
+	/* The queue pushes back while the other thread is draining it */
+	for (i = 0; i < TEST_THREAD_MSGS; i++) {
+		while ((rc = mctp_message_tx(test_thread.mctp, TEST_SRC_EID,
+					     true, i % 8, payload,
+					     sizeof(payload))) == -EBUSY)
+			sched_yield();
+		assert(rc == 0);
+	}
+
+	return NULL;
+}
+
+/*
+ * One thread may transmit while another receives, reassembles and
+ * replies on the same bus.
+ */
+static void mctp_core_test_threads()
+{
+	struct mctp_binding_test *binding;
+	uint8_t payload[2 * MCTP_BTU];
+	struct pktbuf pktbuf;
+	pthread_t tx;
+	int i;
+
+	memset(&test_thread, 0, sizeof(test_thread));
+	mctp_set_alloc_ops(malloc, free, test_thread_msg_alloc,
+			   test_thread_msg_free);
+	mctp_test_stack_init(&test_thread.mctp, &binding, TEST_DEST_EID);
+	((struct mctp_binding *)binding)->tx = test_thread_tx;
+	mctp_set_rx_all(test_thread.mctp, test_thread_rx, NULL);
+
+	memset(payload, 0, sizeof(payload));
+	memset(&pktbuf, 0, sizeof(pktbuf));
+	pktbuf.hdr.dest = TEST_DEST_EID;
+	pktbuf.hdr.src = TEST_SRC_EID;
+
+	assert(pthread_create(&tx, NULL, test_thread_send, NULL) == 0);
+	for (i = 0; i < TEST_THREAD_MSGS; i++)
+		receive_two_fragment_message(binding, payload, MCTP_BTU,
+					     MCTP_BTU, &pktbuf);
+	assert(pthread_join(tx, NULL) == 0);
+
+	assert(test_thread.rx_msgs == TEST_THREAD_MSGS);
+	assert(test_thread.tx_pkts == 3 * TEST_THREAD_MSGS);
+
+	mctp_binding_test_destroy(binding);
+	mctp_destroy(test_thread.mctp);
+}
+#endif
+
+/* clang-format off */
+#define TEST_CASE(test) { #test, test }
+static const struct {
+	const char *name;
+	void (*test)(void);
+} mctp_core_tests[] = {
+	TEST_CASE(mctp_core_test_simple_rx),
+	TEST_CASE(mctp_core_test_receive_equal_length_fragments),
+	TEST_CASE(mctp_core_test_receive_unexpected_smaller_middle_fragment),
+	TEST_CASE(mctp_core_test_receive_unexpected_bigger_middle_fragment),
+	TEST_CASE(mctp_core_test_receive_smaller_end_fragment),
+	TEST_CASE(mctp_core_test_receive_bigger_end_fragment),
+	TEST_CASE(mctp_core_test_drop_large_fragments),
+	TEST_CASE(mctp_core_test_exhaust_context_buffers),
+	TEST_CASE(mctp_core_test_rx_with_tag),
+	TEST_CASE(mctp_core_test_rx_with_tag_multifragment),
+	TEST_CASE(mctp_core_test_rx_with_null_dst_eid),
+	TEST_CASE(mctp_core_test_rx_with_broadcast_dst_eid),
+	TEST_CASE(mctp_core_test_tx_alloc_tag),
+	TEST_CASE(mctp_core_test_tx_tag_expiry),
+	TEST_CASE(mctp_core_test_reassembly_grow),
+	TEST_CASE(mctp_core_test_reassembly_max_size),
+	TEST_CASE(mctp_core_test_reassembly_interleaved),
+	TEST_CASE(mctp_core_test_rx_single_packet_no_alloc),
+	TEST_CASE(mctp_core_test_rx_msg_take),
+	TEST_CASE(mctp_core_test_rx_iov_chain),
+	TEST_CASE(mctp_core_test_reassembly_timeout),
+	TEST_CASE(mctp_core_test_reassembly_evict_lru),
+	TEST_CASE(mctp_core_test_rx_stream),
+	TEST_CASE(mctp_core_test_rx_stream_match),
+	TEST_CASE(mctp_core_test_tx_queue),
+	TEST_CASE(mctp_core_test_tx_gather),
+	TEST_CASE(mctp_core_test_tx_batch),
+	TEST_CASE(mctp_core_test_tx_interleave),
+	TEST_CASE(mctp_core_test_tx_priority),
+	TEST_CASE(mctp_core_test_tx_batch_queued),
+	TEST_CASE(mctp_core_test_tx_done),
+	TEST_CASE(mctp_core_test_tx_batch_nomem),
+	TEST_CASE(mctp_core_test_tx_borrowed),
+	TEST_CASE(mctp_core_test_tx_iov),
+	TEST_CASE(mctp_core_test_tx_request_cb),
+	TEST_CASE(mctp_core_test_tx_request_queue),
+	TEST_CASE(mctp_core_test_multi_bus),
+	TEST_CASE(mctp_core_test_bridge_cut_through),
+	TEST_CASE(mctp_core_test_bridge_mtu),
+#if MCTP_THREAD_SAFE && !defined(_WIN32)
+	TEST_CASE(mctp_core_test_threads),
+#endif
 };
 /* clang-format on */
 
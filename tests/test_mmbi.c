@@ -8,6 +8,7 @@
 
 #include "libmctp-log.h"
 #include "libmctp-mmbi.h"
+#include "ring.h"
 #include "test-utils.h"
 
 #ifdef NDEBUG
@@ -15,9 +16,15 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#if MCTP_THREAD_SAFE && !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #define MMBI_MEM_SIZE 4096
 
@@ -34,13 +41,51 @@ static void rx_message(uint8_t eid, bool tag_owner, uint8_t msg_tag,
 	(void)eid;
 	(void)tag_owner;
 	(void)msg_tag;
-	(void)data;
 	(void)msg;
 	(void)len;
-	/* Just a dummy receiver */
-	// We can check content here if we want detailed validation
+	/* Count the messages delivered, when asked to */
+	if (data)
+		(*(int *)data)++;
+}
+
+#if MCTP_THREAD_SAFE && !defined(_WIN32)
+#define RING_TEST_ITEMS 10000
+
+static void *ring_producer(void *data)
+{
+	struct mctp_ring *ring = data;
+	uintptr_t i;
+
+	for (i = 1; i <= RING_TEST_ITEMS; i++)
+		while (!mctp_ring_push(ring, (void *)i))
+			sched_yield();
+
+	return NULL;
 }
 
+/* Items pass between threads whole and in order */
+static void test_ring_threads(void)
+{
+	struct mctp_ring ring;
+	uintptr_t expect = 1;
+	pthread_t producer;
+	void *item;
+
+	assert(mctp_ring_init(&ring, 16) == 0);
+	assert(pthread_create(&producer, NULL, ring_producer, &ring) == 0);
+	while (expect <= RING_TEST_ITEMS) {
+		item = mctp_ring_pop(&ring);
+		if (item)
+			assert((uintptr_t)item == expect++);
+		else
+			sched_yield();
+	}
+	assert(pthread_join(producer, NULL) == 0);
+	assert(mctp_ring_pop(&ring) == NULL);
+	mctp_ring_destroy(&ring);
+}
+#endif
+
 int main(void)
 {
 	struct test_ctx ctx;
@@ -126,7 +171,89 @@ int main(void)
 	
 	rc = mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data));
 	assert(rc == 0);
-	
+
+	/* Test pipeline mode: RX only queues, until the packets are processed */
+	int rx_count = 0;
+	mctp_set_rx_all(ctx.mctp, rx_message, &rx_count);
+	rc = mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data));
+	assert(rc == 0);
+	assert(rx_count == 1);
+
+	rc = mctp_mmbi_set_pipeline(ctx.mmbi, 2);
+	assert(rc == 0);
+	assert(mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data)) == 0);
+	assert(mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data)) == 0);
+	assert(mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data)) ==
+	       -EBUSY);
+	assert(ctx.mmbi->rx_dropped == 1);
+	assert(rx_count == 1);
+
+	assert(mctp_mmbi_process(ctx.mmbi) == 2);
+	assert(rx_count == 3);
+	assert(mctp_mmbi_process(ctx.mmbi) == 0);
+
+#ifdef __linux__
+	/* Waiting: queued packets and notifications wake the waiter */
+	int wait_count = 0;
+	mctp_set_rx_all(ctx.mctp, rx_message, &wait_count);
+	assert(mctp_mmbi_wait_handle(ctx.mmbi) >= 0);
+	/* Still signalled by the packets queued above */
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 0) == 1);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 0) == 0);
+	assert(mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data)) == 0);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 1000) == 1);
+	assert(wait_count == 1);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 0) == 0);
+	mctp_mmbi_notify(ctx.mmbi);
+	mctp_mmbi_notify(ctx.mmbi);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 0) == 1);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 0) == 0);
+
+	/* Hybrid polling: spin after activity, block once the window ends */
+	struct mctp_mmbi_poll_stats poll_stats;
+	uint64_t blocks;
+	mctp_mmbi_get_poll_stats(ctx.mmbi, &poll_stats);
+	assert(poll_stats.mode == MCTP_MMBI_POLL_BLOCK);
+	assert(poll_stats.spin_waits == 0);
+	blocks = poll_stats.blocks;
+	mctp_mmbi_set_poll_policy(ctx.mmbi, 10000000);
+	assert(mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data)) == 0);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 1000) == 1);
+	assert(wait_count == 2);
+	mctp_mmbi_get_poll_stats(ctx.mmbi, &poll_stats);
+	assert(poll_stats.mode == MCTP_MMBI_POLL_SPIN);
+	assert(poll_stats.spin_waits == 1 && poll_stats.spin_hits == 1);
+	assert(poll_stats.blocks == blocks);
+	/* A miss spins until the timeout */
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 1) == 0);
+	mctp_mmbi_get_poll_stats(ctx.mmbi, &poll_stats);
+	assert(poll_stats.spin_waits == 2 && poll_stats.spin_hits == 1);
+	/* Sending opens the window as well */
+	ctx.mmbi->last_activity_us = 0;
+	rc = mctp_message_tx(ctx.mctp, 9, false, 0, pkt_data, sizeof(pkt_data));
+	assert(rc == 0);
+	assert(ctx.mmbi->last_activity_us != 0);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 1) == 0);
+	mctp_mmbi_get_poll_stats(ctx.mmbi, &poll_stats);
+	assert(poll_stats.spin_waits == 3 && poll_stats.spin_hits == 1);
+	mctp_mmbi_set_poll_policy(ctx.mmbi, 0);
+	assert(mctp_mmbi_poll_wait(ctx.mmbi, 0) == 0);
+	mctp_mmbi_get_poll_stats(ctx.mmbi, &poll_stats);
+	assert(poll_stats.mode == MCTP_MMBI_POLL_BLOCK);
+	assert(poll_stats.blocks == blocks + 1);
+	mctp_set_rx_all(ctx.mctp, rx_message, &rx_count);
+#endif
+
+	/* Packets still queued are passed on when leaving pipeline mode */
+	assert(mctp_mmbi_rx(ctx.mmbi, sizeof(rx_hdr) + sizeof(pkt_data)) == 0);
+	assert(mctp_mmbi_set_pipeline(ctx.mmbi, 0) == 0);
+	assert(mctp_mmbi_process(ctx.mmbi) == -EINVAL);
+	assert(rx_count == 4);
+
+#if MCTP_THREAD_SAFE && !defined(_WIN32)
+	test_ring_threads();
+#endif
+
 	/* Cleanup */
 	mctp_unregister_bus(ctx.mctp, &ctx.mmbi->binding);
 	mctp_mmbi_destroy(ctx.mmbi);
@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: Apache-2.0 OR GPL-2.0-or-later */
+
+#include "test-utils.h"
+
+#include "compiler.h"
+#include "libmctp.h"
+#include "libmctp-alloc.h"
+#include "libmctp-cmds.h"
+#include "libmctp-shard.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#define LOCAL_EID 8
+#define NEW_EID	  9
+#define N_SHARDS  4
+#define DEPTH	  16
+
+static struct {
+	size_t count;
+	struct mctp_hdr hdr;
+} lower_tx;
+
+static int lower_tx_fn(struct mctp_binding *b __unused,
+		       struct mctp_pktbuf *pkt)
+{
+	lower_tx.count++;
+	lower_tx.hdr = *mctp_pktbuf_hdr(pkt);
+	return 0;
+}
+
+static size_t rx_count[N_SHARDS];
+
+static void rx_message(uint8_t eid __unused, bool tag_owner __unused,
+		       uint8_t msg_tag __unused, void *data, void *msg __unused,
+		       size_t len __unused)
+{
+	(*(size_t *)data)++;
+}
+
+static uint64_t test_now(void *ctx __unused)
+{
+	return 1000;
+}
+
+struct resp {
+	int calls;
+	int status;
+};
+
+static void resp_fn(mctp_eid_t eid __unused, uint8_t msg_tag __unused,
+		    int status, void *msg __unused, size_t len __unused,
+		    void *data)
+{
+	struct resp *r = data;
+
+	r->calls++;
+	r->status = status;
+}
+
+static int rx_data(struct mctp_shard_set *set, struct mctp_binding *lower,
+		   mctp_eid_t src, mctp_eid_t dest, uint8_t flags_seq_tag,
+		   const void *payload, size_t len)
+{
+	struct mctp_pktbuf *pkt;
+	struct mctp_hdr *hdr;
+	int rc;
+
+	pkt = mctp_pktbuf_alloc(lower, sizeof(*hdr) + len);
+	assert(pkt);
+	hdr = mctp_pktbuf_hdr(pkt);
+	hdr->ver = 1;
+	hdr->dest = dest;
+	hdr->src = src;
+	hdr->flags_seq_tag = flags_seq_tag;
+	memcpy(hdr + 1, payload, len);
+
+	rc = mctp_shard_rx(set, pkt);
+	mctp_pktbuf_free(pkt);
+	return rc;
+}
+
+static int rx_packet(struct mctp_shard_set *set, struct mctp_binding *lower,
+		     mctp_eid_t src, uint8_t flags_seq_tag)
+{
+	uint8_t payload[4] = { 1, 2, 3, 4 };
+
+	return rx_data(set, lower, src, LOCAL_EID, flags_seq_tag, payload,
+		       sizeof(payload));
+}
+
+int main(void)
+{
+	const uint8_t som_eom = MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_EOM;
+	struct mctp_ctrl_cmd_set_endpoint_id_req set_eid = {
+		.hdr = { MCTP_CTRL_HDR_MSG_TYPE, MCTP_CTRL_HDR_FLAG_REQUEST,
+			 MCTP_CTRL_CMD_SET_ENDPOINT_ID },
+		.operation = MCTP_CTRL_SET_EID_OP_SET,
+		.eid = NEW_EID,
+	};
+	struct mctp_shard_stats stats;
+	struct mctp_binding lower;
+	struct mctp_shard_set *set;
+	struct resp resp = { 0 };
+	uint8_t tag, req = 0x42;
+	unsigned int i;
+	void *msg;
+
+	mctp_set_log_stdio(MCTP_LOG_DEBUG);
+
+	memset(&lower, 0, sizeof(lower));
+	lower.name = "lower";
+	lower.version = 1;
+	lower.pkt_size = MCTP_PACKET_SIZE(MCTP_BTU);
+	lower.tx = lower_tx_fn;
+
+#if !MCTP_THREAD_SAFE
+	/* The shards run on several threads, so need a locked core */
+	assert(!mctp_shard_init(&lower, LOCAL_EID, N_SHARDS, DEPTH));
+	return 0;
+#endif
+
+	assert(!mctp_shard_init(&lower, LOCAL_EID, MCTP_SHARDS_MAX + 1, DEPTH));
+	set = mctp_shard_init(&lower, LOCAL_EID, N_SHARDS, DEPTH);
+	assert(set);
+	assert(mctp_shard_count(set) == N_SHARDS);
+	for (i = 0; i < N_SHARDS; i++) {
+		mctp_set_rx_all(mctp_shard_mctp(set, i), rx_message,
+				&rx_count[i]);
+		mctp_set_now_op(mctp_shard_mctp(set, i), test_now, NULL);
+	}
+
+	/* Packets are steered by (source EID + tag) and wait to be processed */
+	assert(rx_packet(set, &lower, 10, som_eom | MCTP_HDR_FLAG_TO | 1) == 0);
+	assert(mctp_shard_index(set, 10, 1) == 3);
+	assert(rx_count[3] == 0);
+	assert(mctp_shard_process(set, 0) == 0);
+	assert(mctp_shard_process(set, 3) == 1);
+	assert(rx_count[3] == 1);
+
+	/* All the packets of a message go to one shard */
+	assert(rx_packet(set, &lower, 13,
+			 MCTP_HDR_FLAG_SOM | MCTP_HDR_FLAG_TO | 4) == 0);
+	assert(rx_packet(set, &lower, 13,
+			 MCTP_HDR_FLAG_EOM | MCTP_HDR_FLAG_TO | 4 |
+				 (1 << MCTP_HDR_SEQ_SHIFT)) == 0);
+	assert(mctp_shard_process(set, 1) == 2);
+	assert(rx_count[1] == 1);
+
+	/* A shard only picks request tags that bring the response back */
+	msg = __mctp_alloc(1);
+	memcpy(msg, &req, 1);
+	assert(mctp_message_tx_request_cb(mctp_shard_mctp(set, 2), 20, msg, 1,
+					  &tag, resp_fn, &resp) == 0);
+	assert(mctp_shard_index(set, 20, tag) == 2);
+	assert(lower_tx.count == 1);
+	assert(lower_tx.hdr.src == LOCAL_EID && lower_tx.hdr.dest == 20);
+	assert((lower_tx.hdr.flags_seq_tag & MCTP_HDR_TAG_MASK) == tag);
+
+	assert(rx_packet(set, &lower, 20, som_eom | tag) == 0);
+	assert(mctp_shard_process(set, 2) == 1);
+	assert(resp.calls == 1 && resp.status == 0);
+
+	/* Sends for (eid, tag) go out through the owning shard */
+	assert(mctp_shard_message_tx(set, 10, false, 1, &req, 1) == 0);
+	assert(lower_tx.count == 2);
+	assert(lower_tx.hdr.dest == 10);
+
+	/* A Set Endpoint ID through one shard moves all of them */
+	assert(rx_data(set, &lower, 11, LOCAL_EID, som_eom | MCTP_HDR_FLAG_TO,
+		       &set_eid, sizeof(set_eid)) == 0);
+	assert(mctp_shard_process(set, 3) == 1);
+	assert(lower_tx.count == 3);
+	assert(lower_tx.hdr.src == NEW_EID && lower_tx.hdr.dest == 11);
+	assert(rx_data(set, &lower, 13, NEW_EID, som_eom | MCTP_HDR_FLAG_TO,
+		       &req, 1) == 0);
+	assert(mctp_shard_process(set, 1) == 1);
+	assert(rx_count[1] == 2);
+
+	/* A full queue drops packets; queued ones are freed on destroy */
+	for (i = 0; i < DEPTH; i++)
+		assert(rx_packet(set, &lower, 12, som_eom | 0) == 0);
+	assert(rx_packet(set, &lower, 12, som_eom | 0) == -EBUSY);
+	mctp_shard_get_stats(set, 0, &stats);
+	assert(stats.rx == DEPTH && stats.dropped == 1);
+
+	mctp_shard_destroy(set);
+
+	return 0;
+}
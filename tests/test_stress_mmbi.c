@@ -222,7 +222,7 @@ int run_endpoint(const char *role, const char *mode) {
              printf("[%s] Waiting for data...\n", role);
              time_t start = time(NULL);
              while (!rx_complete && (time(NULL) - start < 120)) {
-                 mctp_mmbi_poll(mmbi);
+                 mctp_mmbi_poll_wait(mmbi, 100);
              }
              if (!rx_complete) return 1;
         }
@@ -240,14 +240,14 @@ int run_endpoint(const char *role, const char *mode) {
              rx_complete = false;
              time_t start = time(NULL);
              while (!rx_complete && (time(NULL) - start < 60)) {
-                 mctp_mmbi_poll(mmbi);
+                 mctp_mmbi_poll_wait(mmbi, 100);
              }
              if (!rx_complete) return 1;
         } else {
              printf("[%s] Waiting for data...\n", role);
              time_t start = time(NULL);
              while (!rx_complete && (time(NULL) - start < 120)) {
-                 mctp_mmbi_poll(mmbi);
+                 mctp_mmbi_poll_wait(mmbi, 100);
              }
              if (!rx_complete) return 1;
              